@@ -1,5 +1,6 @@
 #include <vector>
 #include <cstring>
+#include <string>
 
 #include <GL/glew.h>
 
@@ -13,31 +14,181 @@ using namespace glm;
 #include "text2D.hpp"
 
 unsigned int Text2DTextureID;
+unsigned int Text2DVertexArrayID;
 unsigned int Text2DVertexBufferID;
 unsigned int Text2DUVBufferID;
 unsigned int Text2DShaderID;
 unsigned int Text2DUniformID;
+unsigned int Text2DScreenSizeID;
+
+const std::string TEXT_VERTEX_SHADER = R"(
+#version 330 core
+
+// Input vertex data, different for all executions of this shader.
+layout(location = 0) in vec2 vertexPosition_screenspace;
+layout(location = 1) in vec2 vertexUV;
+
+// Output data ; will be interpolated for each fragment.
+out vec2 UV;
+
+// Viewport size in pixels, (0,0) is the bottom left corner
+uniform vec2 screenSize;
+
+void main(){
+
+	// Output position of the vertex, in clip space
+	gl_Position = vec4(vertexPosition_screenspace / screenSize * 2.0 - 1.0, 0, 1);
+
+	// UV of the vertex. No special space for this one.
+	UV = vertexUV;
+}
+)";
+
+const std::string TEXT_FRAGMENT_SHADER = R"(
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 UV;
+
+// Ouput data
+out vec4 color;
+
+// Values that stay constant for the whole mesh.
+uniform sampler2D myTextureSampler;
+
+void main(){
+
+	color = texture( myTextureSampler, UV );
+}
+)";
+
+// 5x7 glyphs, one byte per row with the leftmost pixel in bit 4. Lower case
+// letters use the upper case glyphs, anything else is left blank.
+struct Glyph {
+	char character;
+	unsigned char rows[7];
+};
+
+static const Glyph BUILT_IN_FONT[] = {
+    { '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+    { '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+    { '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+    { '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+    { '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+    { '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+    { '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+    { '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+    { 'A', { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+    { 'B', { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e } },
+    { 'C', { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e } },
+    { 'D', { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c } },
+    { 'E', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f } },
+    { 'F', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 } },
+    { 'G', { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f } },
+    { 'H', { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+    { 'I', { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+    { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c } },
+    { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+    { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f } },
+    { 'M', { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+    { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+    { 'O', { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+    { 'P', { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 } },
+    { 'Q', { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d } },
+    { 'R', { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 } },
+    { 'S', { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e } },
+    { 'T', { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+    { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+    { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+    { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a } },
+    { 'X', { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 } },
+    { 'Y', { 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 } },
+    { 'Z', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+    { ',', { 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 } },
+    { ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+    { '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+    { '+', { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 } },
+    { '=', { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 } },
+    { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+    { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+    { '_', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f } },
+    { '|', { 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+};
+
+// The same layout as the tutorial's DDS fonts: 16x16 cells, character c in
+// cell (c%16, c/16), the top row first
+static GLuint createBuiltInFontTexture(){
+
+	const int cell = 8;
+	const int size = 16 * cell;
+	std::vector<unsigned char> pixels(size * size * 4, 0);
+
+	for (const Glyph& glyph : BUILT_IN_FONT) {
+		for (int pass = 0; pass < 2; pass++) {
+			int character = glyph.character;
+			if (pass == 1) {
+				if (character < 'A' || character > 'Z') break;
+				character += 'a' - 'A';
+			}
+
+			int left = (character % 16) * cell + 1;
+			int top = (character / 16) * cell;
+
+			for (int y = 0; y < 7; y++) {
+				for (int x = 0; x < 5; x++) {
+					if (glyph.rows[y] & (0x10 >> x)) {
+						unsigned char* pixel = &pixels[((top + y) * size + left + x) * 4];
+						pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+					}
+				}
+			}
+		}
+	}
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	// Crisp pixels, text is drawn at whole multiples of the cell size
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return textureID;
+}
 
 void initText2D(const char * texturePath){
 
 	// Initialize texture
-	Text2DTextureID = loadDDS(texturePath);
+	Text2DTextureID = texturePath != NULL ? loadDDS(texturePath) : createBuiltInFontTexture();
+
+	// Own vertex array, so the caller's attribute setup is left alone
+	glGenVertexArrays(1, &Text2DVertexArrayID);
 
 	// Initialize VBO
 	glGenBuffers(1, &Text2DVertexBufferID);
 	glGenBuffers(1, &Text2DUVBufferID);
 
 	// Initialize Shader
-	Text2DShaderID = LoadShaders( "TextVertexShader.vertexshader", "TextVertexShader.fragmentshader" );
+	Text2DShaderID = LoadShaders( TEXT_VERTEX_SHADER, TEXT_FRAGMENT_SHADER );
 
 	// Initialize uniforms' IDs
 	Text2DUniformID = glGetUniformLocation( Text2DShaderID, "myTextureSampler" );
+	Text2DScreenSizeID = glGetUniformLocation( Text2DShaderID, "screenSize" );
 
 }
 
 void printText2D(const char * text, int x, int y, int size){
 
 	unsigned int length = strlen(text);
+	if (length == 0) return;
 
 	// Fill buffers
 	std::vector<glm::vec2> vertices;
@@ -81,12 +232,18 @@ void printText2D(const char * text, int x, int y, int size){
 	// Bind shader
 	glUseProgram(Text2DShaderID);
 
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glUniform2f(Text2DScreenSizeID, (float)viewport[2], (float)viewport[3]);
+
 	// Bind texture
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, Text2DTextureID);
 	// Set our "myTextureSampler" sampler to use Texture Unit 0
 	glUniform1i(Text2DUniformID, 0);
 
+	glBindVertexArray(Text2DVertexArrayID);
+
 	// 1rst attribute buffer : vertices
 	glEnableVertexAttribArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
@@ -99,11 +256,15 @@ void printText2D(const char * text, int x, int y, int size){
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// Text goes over everything
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
 
 	// Draw call
 	glDrawArrays(GL_TRIANGLES, 0, vertices.size() );
 
 	glDisable(GL_BLEND);
+	if (depthTest) glEnable(GL_DEPTH_TEST);
 
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
@@ -115,6 +276,7 @@ void cleanupText2D(){
 	// Delete buffers
 	glDeleteBuffers(1, &Text2DVertexBufferID);
 	glDeleteBuffers(1, &Text2DUVBufferID);
+	glDeleteVertexArrays(1, &Text2DVertexArrayID);
 
 	// Delete texture
 	glDeleteTextures(1, &Text2DTextureID);
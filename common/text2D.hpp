@@ -1,6 +1,7 @@
 #ifndef TEXT2D_HPP
 #define TEXT2D_HPP
 
+// Loads a DDS font, or uses a small built-in one when texturePath is NULL
 void initText2D(const char * texturePath);
 void printText2D(const char * text, int x, int y, int size);
 void cleanupText2D();
@@ -13105,6 +13105,8 @@ GLenum glxewInit (GLXEW_CONTEXT_ARG_DEF_LIST)
   const GLubyte* extEnd;
   /* initialize core GLX 1.2 */
   if (_glewInit_GLX_VERSION_1_2(GLEW_CONTEXT_ARG_VAR_INIT)) return GLEW_ERROR_GLX_VERSION_11_ONLY;
+  /* no GLX display, e.g. a context made current through EGL (backported from GLEW 2.0) */
+  if (glXGetCurrentDisplay == NULL || glXGetCurrentDisplay() == NULL) return GLEW_ERROR_NO_GLX_DISPLAY;
   /* initialize flags */
   GLXEW_VERSION_1_0 = GL_TRUE;
   GLXEW_VERSION_1_1 = GL_TRUE;
@@ -0,0 +1,200 @@
+#include "AdaptiveSampler.h"
+
+#include "CpuKernel.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+// Steps of the R2 sequence, which spreads any number of samples evenly
+// over the pixel: http://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+static const double R2_X = 0.7548776662466927;
+static const double R2_Y = 0.5698402909980532;
+
+// Pixels handed to a thread at a time
+static const size_t CHUNK_PIXELS = 16;
+
+AdaptiveSampler::AdaptiveSampler(const Tile::Bounds& bounds, int width, int height, const Colorizer& colorizer, int maxSamples, double budget) :
+    m_bounds(bounds),
+    m_width(width),
+    m_height(height),
+    m_colorizer(colorizer),
+    m_maxSamples(maxSamples),
+    m_budget(budget),
+    m_pixelsDone(0),
+    m_statistics{ 0, 0 }
+{
+    assert(width > 0 && height > 0 && maxSamples >= 1 && budget >= 0.0);
+}
+
+void AdaptiveSampler::resolveRows(const float* depth, int firstRow, int rows, unsigned char* rgb)
+{
+    size_t count = (size_t)m_width * rows;
+    m_colorizer.colorize(depth, count, rgb);
+
+    // Neighbors across the band's edges
+    std::vector<unsigned char> above, below;
+    if (firstRow > 0) {
+        above.resize((size_t)m_width * 3);
+        renderRow(firstRow - 1, above.data());
+    }
+    if (firstRow + rows < m_height) {
+        below.resize((size_t)m_width * 3);
+        renderRow(firstRow + rows, below.data());
+    }
+
+    auto colorAt = [&](int x, int y) -> const unsigned char* {
+        if (x < 0 || x >= m_width) return nullptr;
+        if (y < 0) return above.empty() ? nullptr : above.data() + x * 3;
+        if (y >= rows) return below.empty() ? nullptr : below.data() + x * 3;
+        return rgb + ((size_t)y * m_width + x) * 3;
+    };
+
+    struct Pixel {
+        size_t index;
+        int contrast;
+        int sum[3];
+        int samples;
+        bool done;
+    };
+
+    std::vector<Pixel> pixels;
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < m_width; ++x) {
+            const unsigned char* color = colorAt(x, y);
+            const unsigned char* neighbors[] = { colorAt(x - 1, y), colorAt(x + 1, y), colorAt(x, y - 1), colorAt(x, y + 1) };
+
+            int contrast = 0;
+            for (auto neighbor : neighbors) {
+                if (neighbor == nullptr) continue;
+                for (int c = 0; c < 3; ++c) {
+                    contrast = std::max(contrast, abs(neighbor[c] - color[c]));
+                }
+            }
+
+            if (contrast > THRESHOLD) {
+                pixels.push_back({ (size_t)y * m_width + x, contrast, { color[0], color[1], color[2] }, 1, false });
+            }
+        }
+    }
+
+    if (m_maxSamples <= 1 || pixels.empty()) {
+        m_pixelsDone += count;
+        return;
+    }
+
+    // The strongest edges first, for when the budget runs out
+    std::stable_sort(pixels.begin(), pixels.end(), [](const Pixel& a, const Pixel& b) { return a.contrast > b.contrast; });
+
+    double allowed = m_budget * (m_pixelsDone + count) - m_statistics.extraSamples;
+    size_t budgetLeft = allowed > 0.0 ? (size_t)allowed : 0;
+    m_pixelsDone += count;
+
+    auto sample = [&](Pixel& pixel) {
+        int px = (int)(pixel.index % m_width);
+        int py = firstRow + (int)(pixel.index / m_width);
+
+        // Each pixel starts the sequence somewhere else, so neighbors'
+        // samples don't line up into patterns
+        uint32_t hash = (uint32_t)px * 0x9E3779B1u ^ (uint32_t)py * 0x85EBCA77u;
+        hash ^= hash >> 15;
+        hash *= 0x2C1B3C6Du;
+        hash ^= hash >> 13;
+        double startX = (hash & 0xffff) / 65536.0;
+        double startY = (hash >> 16) / 65536.0;
+
+        double pixelWidth = ((double)m_bounds.right - m_bounds.left) / m_width;
+        double pixelHeight = ((double)m_bounds.bottom - m_bounds.top) / m_height;
+
+        float values[SAMPLES_PER_ROUND];
+        int taken = std::min(SAMPLES_PER_ROUND, m_maxSamples - pixel.samples);
+        for (int i = 0; i < taken; ++i) {
+            double n = pixel.samples + i;
+            double u = startX + n * R2_X;
+            double v = startY + n * R2_Y;
+            u -= floor(u);
+            v -= floor(v);
+
+            values[i] = CpuKernel::renderPoint(m_bounds.left + (px + u) * pixelWidth, m_bounds.top + (py + v) * pixelHeight, m_bounds.maxIt);
+        }
+
+        unsigned char colors[SAMPLES_PER_ROUND * 3];
+        m_colorizer.colorize(values, taken, colors);
+
+        int change = 0;
+        for (int c = 0; c < 3; ++c) {
+            int sum = pixel.sum[c];
+            for (int i = 0; i < taken; ++i) {
+                sum += colors[i * 3 + c];
+            }
+
+            // |sum / (samples + taken) - pixel.sum / samples| in whole steps
+            int moved = abs(sum * pixel.samples - pixel.sum[c] * (pixel.samples + taken)) / (pixel.samples * (pixel.samples + taken));
+            change = std::max(change, moved);
+            pixel.sum[c] = sum;
+        }
+
+        pixel.samples += taken;
+        pixel.done = change <= CONVERGED || pixel.samples >= m_maxSamples;
+    };
+
+    std::vector<Pixel*> active;
+    for (auto& pixel : pixels) {
+        active.push_back(&pixel);
+    }
+
+    while (!active.empty()) {
+        size_t affordable = budgetLeft / SAMPLES_PER_ROUND;
+        if (affordable == 0) break;
+        if (active.size() > affordable) {
+            active.resize(affordable);
+        }
+
+        size_t roundSamples = 0;
+        for (auto pixel : active) {
+            roundSamples += std::min(SAMPLES_PER_ROUND, m_maxSamples - pixel->samples);
+        }
+
+        std::atomic<size_t> next(0);
+        CpuKernel::runOnEveryCore([&]() {
+            size_t first;
+            while ((first = next.fetch_add(CHUNK_PIXELS)) < active.size()) {
+                size_t last = std::min(first + CHUNK_PIXELS, active.size());
+                for (size_t i = first; i < last; ++i) {
+                    sample(*active[i]);
+                }
+            }
+        });
+
+        budgetLeft -= roundSamples;
+        m_statistics.extraSamples += roundSamples;
+
+        active.erase(std::remove_if(active.begin(), active.end(), [](const Pixel* pixel) { return pixel->done; }), active.end());
+    }
+
+    for (const auto& pixel : pixels) {
+        if (pixel.samples == 1) continue;
+
+        unsigned char* color = rgb + pixel.index * 3;
+        for (int c = 0; c < 3; ++c) {
+            color[c] = (unsigned char)((pixel.sum[c] + pixel.samples / 2) / pixel.samples);
+        }
+        ++m_statistics.refinedPixels;
+    }
+}
+
+AdaptiveSampler::Statistics AdaptiveSampler::getStatistics() const
+{
+    return m_statistics;
+}
+
+void AdaptiveSampler::renderRow(int row, unsigned char* rgb) const
+{
+    std::vector<float> depth(m_width);
+    CpuKernel::renderRows(m_bounds, m_width, m_height, row, 1, depth.data());
+    m_colorizer.colorize(depth.data(), m_width, rgb);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Colorizer.h"
+#include "Tile.h"
+
+#include <stddef.h>
+
+// Anti-aliases a rendered image where it needs it. Colors pixels from their
+// single sample like Colorizer, then finds the ones whose color differs
+// strongly from a neighbor's and averages jittered sub-samples across them,
+// in rounds, until a pixel's average settles or it reaches maxSamples.
+// Smooth areas cost nothing extra, which is most of any image.
+// Works on bands of rows top to bottom, as StreamingExporter writes them.
+class AdaptiveSampler {
+public:
+    struct Statistics {
+        // Pixels given any sub-samples
+        size_t refinedPixels;
+        size_t extraSamples;
+    };
+
+    // At most maxSamples per pixel, the first included, and on average no
+    // more than budget extra ones per pixel over the image. The strongest
+    // edges of each band get theirs first.
+    AdaptiveSampler(const Tile::Bounds& bounds, int width, int height, const Colorizer& colorizer, int maxSamples, double budget);
+
+    // Fills rgb (width * rows * 3) with rows [firstRow, firstRow + rows) of
+    // the image, from their rendered values in depth. Rows must come in
+    // order.
+    void resolveRows(const float* depth, int firstRow, int rows, unsigned char* rgb);
+
+    Statistics getStatistics() const;
+
+private:
+    // Largest difference in any channel, of 255, which counts as an edge
+    static const int THRESHOLD = 26;
+    // A pixel is done once a round moves its average no more than this
+    static const int CONVERGED = 1;
+    static const int SAMPLES_PER_ROUND = 4;
+
+    Tile::Bounds m_bounds;
+    int m_width;
+    int m_height;
+    const Colorizer& m_colorizer;
+    int m_maxSamples;
+    double m_budget;
+
+    size_t m_pixelsDone;
+    Statistics m_statistics;
+
+    // Colors of a row just outside the band, rendered for the edge test
+    void renderRow(int row, unsigned char* rgb) const;
+};
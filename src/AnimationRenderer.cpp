@@ -0,0 +1,254 @@
+#include "AnimationRenderer.h"
+
+#include "CpuKernel.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+// Same root as the game's first tile
+static const double ROOT_LEFT = -2.5;
+static const double ROOT_TOP = -2.0;
+static const double ROOT_SIZE = 4.0;
+
+// Past this, float tile bounds can't tell samples apart anyway
+static const int MAX_LEVEL = 40;
+
+std::vector<AnimationRenderer::Keyframe> AnimationRenderer::loadKeyframes(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    std::vector<Keyframe> keyframes;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        Keyframe keyframe;
+        if (!(fields >> keyframe.frame >> keyframe.centerX >> keyframe.centerY >> keyframe.width >> keyframe.cutoff)) {
+            throw std::runtime_error("Malformed keyframe: " + line);
+        }
+        if (keyframe.width <= 0.0 || (!keyframes.empty() && keyframe.frame <= keyframes.back().frame)) {
+            throw std::runtime_error("Keyframes need a positive width and increasing frames: " + line);
+        }
+        keyframes.push_back(keyframe);
+    }
+
+    if (keyframes.empty()) {
+        throw std::runtime_error("No keyframes in " + path);
+    }
+    return keyframes;
+}
+
+AnimationRenderer::AnimationRenderer(const std::vector<Keyframe>& keyframes, int widthPx, int heightPx, int maxIt) :
+    m_keyframes(keyframes),
+    m_widthPx(widthPx),
+    m_heightPx(heightPx),
+    m_maxIt(maxIt),
+    m_statistics{ 0, 0, 0 }
+{
+    assert(!m_keyframes.empty());
+}
+
+int AnimationRenderer::getFrameCount() const
+{
+    return m_keyframes.back().frame - m_keyframes.front().frame + 1;
+}
+
+AnimationRenderer::View AnimationRenderer::getView(int frame) const
+{
+    if (frame <= m_keyframes.front().frame) {
+        const auto& first = m_keyframes.front();
+        return { first.centerX, first.centerY, first.width, first.cutoff };
+    }
+    if (frame >= m_keyframes.back().frame) {
+        const auto& last = m_keyframes.back();
+        return { last.centerX, last.centerY, last.width, last.cutoff };
+    }
+
+    size_t next = 1;
+    while (m_keyframes[next].frame < frame) ++next;
+
+    const auto& a = m_keyframes[next - 1];
+    const auto& b = m_keyframes[next];
+    double t = (double)(frame - a.frame) / (b.frame - a.frame);
+
+    return {
+        a.centerX + (b.centerX - a.centerX) * t,
+        a.centerY + (b.centerY - a.centerY) * t,
+        // Constant zoom speed between keyframes
+        a.width * std::pow(b.width / a.width, t),
+        (float)(a.cutoff + (b.cutoff - a.cutoff) * t)
+    };
+}
+
+void AnimationRenderer::run(const std::function<void(int frame, const float* depth, const View& view)>& frameDone)
+{
+    const int firstFrame = m_keyframes.front().frame;
+    const int frameCount = getFrameCount();
+
+    // Plan every frame first, to know when each tile is last needed
+    std::vector<Coverage> coverages;
+    std::map<TileKey, int> lastUse;
+
+    for (int i = 0; i < frameCount; ++i) {
+        Coverage coverage = getCoverage(getView(firstFrame + i));
+        coverages.push_back(coverage);
+
+        for (long long y = coverage.firstTileY; y <= coverage.lastTileY; ++y) {
+            for (long long x = coverage.firstTileX; x <= coverage.lastTileX; ++x) {
+                lastUse[TileKey(coverage.level, x, y)] = i;
+                ++m_statistics.tilesShown;
+            }
+        }
+    }
+
+    std::vector<float> depth((size_t)m_widthPx * m_heightPx);
+
+    for (int i = 0; i < frameCount; ++i) {
+        const Coverage& coverage = coverages[i];
+
+        for (long long y = coverage.firstTileY; y <= coverage.lastTileY; ++y) {
+            for (long long x = coverage.firstTileX; x <= coverage.lastTileX; ++x) {
+                TileKey key(coverage.level, x, y);
+                if (m_cache.count(key) != 0) continue;
+
+                std::unique_ptr<float[]> samples(new float[(size_t)TILE_SIZE * TILE_SIZE]);
+                CpuKernel::render(getTileBounds(key), TILE_SIZE, TILE_SIZE, samples.get());
+                m_cache[key] = std::move(samples);
+                ++m_statistics.tilesRendered;
+            }
+        }
+        m_statistics.peakCachedTiles = std::max(m_statistics.peakCachedTiles, (int)m_cache.size());
+
+        View view = getView(firstFrame + i);
+        composite(view, coverage, depth.data());
+        frameDone(firstFrame + i, depth.data(), view);
+
+        // Evict what no later frame shows
+        for (long long y = coverage.firstTileY; y <= coverage.lastTileY; ++y) {
+            for (long long x = coverage.firstTileX; x <= coverage.lastTileX; ++x) {
+                TileKey key(coverage.level, x, y);
+                if (lastUse[key] == i) {
+                    m_cache.erase(key);
+                }
+            }
+        }
+    }
+}
+
+AnimationRenderer::Statistics AnimationRenderer::getStatistics() const
+{
+    return m_statistics;
+}
+
+AnimationRenderer::Coverage AnimationRenderer::getCoverage(const View& view) const
+{
+    double pixelSize = view.width / m_widthPx;
+    double left = view.centerX - view.width / 2;
+    double top = view.centerY - pixelSize * m_heightPx / 2;
+
+    // Level L has 2^L tiles across the root, TILE_SIZE samples each
+    int level = (int)std::ceil(std::log2(ROOT_SIZE / (TILE_SIZE * pixelSize)));
+    level = std::min(std::max(level, 0), MAX_LEVEL);
+
+    double spacing = ROOT_SIZE / (std::ldexp(1.0, level) * TILE_SIZE);
+    long long sampleCount = (1LL << level) * TILE_SIZE;
+
+    auto nearestSample = [&](double offset) {
+        return (long long)std::floor(offset / spacing + 0.5);
+    };
+
+    // Samples of the first and last pixels, clamped to the root
+    long long firstX = std::max(0LL, nearestSample(left - ROOT_LEFT));
+    long long lastX = std::min(sampleCount - 1, nearestSample(left - ROOT_LEFT + (m_widthPx - 1) * pixelSize));
+    long long firstY = std::max(0LL, nearestSample(top - ROOT_TOP));
+    long long lastY = std::min(sampleCount - 1, nearestSample(top - ROOT_TOP + (m_heightPx - 1) * pixelSize));
+
+    Coverage coverage;
+    coverage.level = level;
+    coverage.firstTileX = firstX / TILE_SIZE;
+    coverage.firstTileY = firstY / TILE_SIZE;
+    // Empty ranges when the frame misses the root entirely
+    coverage.lastTileX = lastX < firstX ? coverage.firstTileX - 1 : lastX / TILE_SIZE;
+    coverage.lastTileY = lastY < firstY ? coverage.firstTileY - 1 : lastY / TILE_SIZE;
+
+    return coverage;
+}
+
+Tile::Bounds AnimationRenderer::getTileBounds(const TileKey& key) const
+{
+    double tileSize = ROOT_SIZE / std::ldexp(1.0, std::get<0>(key));
+    double left = ROOT_LEFT + std::get<1>(key) * tileSize;
+    double top = ROOT_TOP + std::get<2>(key) * tileSize;
+
+    return {
+        (float)left,
+        (float)(left + tileSize),
+        (float)top,
+        (float)(top + tileSize),
+        (float)m_maxIt
+    };
+}
+
+void AnimationRenderer::composite(const View& view, const Coverage& coverage, float* depth) const
+{
+    const float outside = std::numeric_limits<float>::infinity();
+
+    double pixelSize = view.width / m_widthPx;
+    double left = view.centerX - view.width / 2;
+    double top = view.centerY - pixelSize * m_heightPx / 2;
+
+    double spacing = ROOT_SIZE / (std::ldexp(1.0, coverage.level) * TILE_SIZE);
+    long long sampleCount = (1LL << coverage.level) * TILE_SIZE;
+
+    // Nearest sampling, like the game's tile textures. -1 is outside the root.
+    auto toSample = [&](double offset) {
+        long long sample = (long long)std::floor(offset / spacing + 0.5);
+        return (sample < 0 || sample >= sampleCount) ? -1LL : sample;
+    };
+
+    std::vector<long long> columns(m_widthPx);
+    for (int x = 0; x < m_widthPx; ++x) {
+        columns[x] = toSample(left - ROOT_LEFT + x * pixelSize);
+    }
+
+    std::vector<const float*> tileRow;
+
+    for (int y = 0; y < m_heightPx; ++y) {
+        float* row = depth + (size_t)y * m_widthPx;
+        long long sampleY = toSample(top - ROOT_TOP + y * pixelSize);
+
+        if (sampleY < 0) {
+            std::fill(row, row + m_widthPx, outside);
+            continue;
+        }
+
+        long long tileY = sampleY / TILE_SIZE;
+        size_t rowOffset = (size_t)(sampleY % TILE_SIZE) * TILE_SIZE;
+
+        // Look the row's tiles up once, not per pixel
+        tileRow.clear();
+        for (long long tileX = coverage.firstTileX; tileX <= coverage.lastTileX; ++tileX) {
+            tileRow.push_back(m_cache.at(TileKey(coverage.level, tileX, tileY)).get());
+        }
+
+        for (int x = 0; x < m_widthPx; ++x) {
+            long long sampleX = columns[x];
+            if (sampleX < 0) {
+                row[x] = outside;
+                continue;
+            }
+
+            const float* tile = tileRow[(size_t)(sampleX / TILE_SIZE - coverage.firstTileX)];
+            row[x] = tile[rowOffset + sampleX % TILE_SIZE];
+        }
+    }
+}
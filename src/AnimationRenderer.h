@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Tile.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Renders a zoom animation offline from a keyframe path. Frames are
+// composited from a quadtree of fixed-size tiles over the same root as the
+// game, and each tile is computed once however many frames show it, so the
+// cost follows the unique area covered rather than the frame count.
+// Tiles are dropped after the last frame that uses them.
+class AnimationRenderer {
+public:
+    struct Keyframe {
+        int frame;
+        double centerX;
+        double centerY;
+        // Of the view in the complex plane
+        double width;
+        float cutoff;
+    };
+
+    struct View {
+        double centerX;
+        double centerY;
+        double width;
+        float cutoff;
+    };
+
+    struct Statistics {
+        // Distinct tiles rendered
+        int tilesRendered;
+        // Sum over frames of the tiles each one shows
+        long long tilesShown;
+        int peakCachedTiles;
+    };
+
+    // Width and height of every tile, in samples
+    static const int TILE_SIZE = 512;
+
+    // One keyframe per line: frame centerX centerY width cutoff
+    // Blank lines and lines starting with # are skipped
+    // Throws std::runtime_error if the file can't be read or is malformed
+    static std::vector<Keyframe> loadKeyframes(const std::string& path);
+
+    // Keyframes must be in increasing frame order
+    AnimationRenderer(const std::vector<Keyframe>& keyframes, int widthPx, int heightPx, int maxIt);
+
+    // From the first keyframe's frame to the last one's, inclusive
+    int getFrameCount() const;
+
+    // The zoom is interpolated geometrically, everything else linearly
+    View getView(int frame) const;
+
+    // Composites every frame in order. frameDone gets the frame number, the
+    // smoothed iteration counts (widthPx * heightPx, top row first, +inf
+    // outside the root tile) and the frame's view.
+    void run(const std::function<void(int frame, const float* depth, const View& view)>& frameDone);
+
+    Statistics getStatistics() const;
+
+private:
+    // level, x, y
+    typedef std::tuple<int, long long, long long> TileKey;
+
+    // Range of tiles a frame reads, at the level it reads from
+    struct Coverage {
+        int level;
+        long long firstTileX;
+        long long lastTileX;
+        long long firstTileY;
+        long long lastTileY;
+    };
+
+    std::vector<Keyframe> m_keyframes;
+    int m_widthPx;
+    int m_heightPx;
+    int m_maxIt;
+
+    std::map<TileKey, std::unique_ptr<float[]>> m_cache;
+    Statistics m_statistics;
+
+    // The coarsest level with samples at least as dense as the frame's pixels
+    Coverage getCoverage(const View& view) const;
+
+    Tile::Bounds getTileBounds(const TileKey& key) const;
+
+    void composite(const View& view, const Coverage& coverage, float* depth) const;
+};
@@ -61,6 +61,21 @@ mat4 Camera::getMvp() const
     return mvp;
 }
 
+double Camera::getCenterX() const
+{
+    return m_centerX;
+}
+
+double Camera::getCenterY() const
+{
+    return m_centerY;
+}
+
+double Camera::getZoom() const
+{
+    return m_zoom;
+}
+
 double Camera::getCutoff() const
 {
     return m_cutoff;
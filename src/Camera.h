@@ -17,6 +17,9 @@ public:
     void setDimensionsPx(int width, int height);
 
     glm::mat4 getMvp() const;
+    double getCenterX() const;
+    double getCenterY() const;
+    double getZoom() const;
     double getCutoff() const;
     Tile::Bounds getBounds() const;
     int getWidthPx() const;
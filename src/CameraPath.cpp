@@ -0,0 +1,106 @@
+#include "CameraPath.h"
+
+#include "Camera.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+CameraPath CameraPath::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    CameraPath cameraPath;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        Sample sample;
+        if (!(fields >> sample.time >> sample.centerX >> sample.centerY >> sample.zoom >> sample.cutoff)) {
+            throw std::runtime_error("Malformed camera sample: " + line);
+        }
+        if (sample.zoom <= 0.0 || (!cameraPath.m_samples.empty() && sample.time < cameraPath.m_samples.back().time)) {
+            throw std::runtime_error("Camera samples need a positive zoom and increasing times: " + line);
+        }
+        cameraPath.m_samples.push_back(sample);
+    }
+
+    if (cameraPath.m_samples.empty()) {
+        throw std::runtime_error("No camera samples in " + path);
+    }
+    return cameraPath;
+}
+
+void CameraPath::save(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    file.precision(17);
+    file << "# time centerX centerY zoom cutoff\n";
+    for (const auto& sample : m_samples) {
+        file << sample.time << " " << sample.centerX << " " << sample.centerY << " " << sample.zoom << " " << sample.cutoff << "\n";
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+void CameraPath::record(double time, const Camera& camera)
+{
+    assert(m_samples.empty() || time >= m_samples.back().time);
+
+    m_samples.push_back({ time, camera.getCenterX(), camera.getCenterY(), camera.getZoom(), camera.getCutoff() });
+}
+
+void CameraPath::apply(double time, Camera& camera) const
+{
+    assert(!m_samples.empty());
+
+    // First sample after the time, the one before it is where the segment starts
+    auto next = std::upper_bound(m_samples.begin(), m_samples.end(), time, [](double t, const Sample& sample) {
+        return t < sample.time;
+    });
+
+    Sample sample;
+    if (next == m_samples.begin()) {
+        sample = m_samples.front();
+    }
+    else if (next == m_samples.end()) {
+        sample = m_samples.back();
+    }
+    else {
+        const auto& a = *(next - 1);
+        const auto& b = *next;
+        double t = (time - a.time) / (b.time - a.time);
+
+        sample.centerX = a.centerX + (b.centerX - a.centerX) * t;
+        sample.centerY = a.centerY + (b.centerY - a.centerY) * t;
+        sample.zoom = a.zoom * std::pow(b.zoom / a.zoom, t);
+        sample.cutoff = a.cutoff + (b.cutoff - a.cutoff) * t;
+    }
+
+    camera.setCenter(sample.centerX, sample.centerY);
+    camera.setZoom(sample.zoom);
+    camera.setCutoff(sample.cutoff);
+}
+
+double CameraPath::getDuration() const
+{
+    return m_samples.empty() ? 0.0 : m_samples.back().time;
+}
+
+bool CameraPath::isEmpty() const
+{
+    return m_samples.empty();
+}
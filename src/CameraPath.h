@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Camera;
+
+// A camera movement over time, recorded from a session or written by hand,
+// which can be replayed on any machine. Stored one sample per line:
+//     time centerX centerY zoom cutoff
+// with time in seconds. Lines starting with # are ignored.
+class CameraPath {
+public:
+    struct Sample {
+        double time;
+        double centerX;
+        double centerY;
+        double zoom;
+        double cutoff;
+    };
+
+    CameraPath() = default;
+
+    static CameraPath load(const std::string& path);
+    void save(const std::string& path) const;
+
+    // Appends where the camera is now. Times must not go backwards.
+    void record(double time, const Camera& camera);
+
+    // Moves the camera to where the path is at the given time. Zoom is
+    // interpolated geometrically, so a steady zoom stays steady.
+    void apply(double time, Camera& camera) const;
+
+    // Time of the last sample
+    double getDuration() const;
+    bool isEmpty() const;
+
+private:
+    std::vector<Sample> m_samples;
+};
@@ -0,0 +1,199 @@
+#include "Colorizer.h"
+
+#include <cmath>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLORIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+static uint32_t packRgba(unsigned char red, unsigned char green, unsigned char blue)
+{
+    return red | (green << 8) | (blue << 16) | (0xFFu << 24);
+}
+
+Colorizer::Colorizer(const Palette& palette, float colorPeriod, float cutoff) :
+    m_paletteSize(palette.getSize()),
+    m_inversePeriod(1.f / colorPeriod),
+    m_cutoff(cutoff)
+{
+    const unsigned char* colors = palette.getData();
+    for (int i = 0; i < m_paletteSize; ++i) {
+        const unsigned char* color = colors + i * 3;
+        const unsigned char* next = colors + ((i + 1) % m_paletteSize) * 3;
+
+        uint64_t first = packRgba(color[0], color[1], color[2]);
+        uint64_t second = packRgba(next[0], next[1], next[2]);
+        m_table.push_back(first | (second << 32));
+    }
+
+    setBackground(0.f, 0.f, 0.f);
+}
+
+void Colorizer::setBackground(float red, float green, float blue)
+{
+    m_background = packRgba(
+        (unsigned char)std::lround(red * 255.f),
+        (unsigned char)std::lround(green * 255.f),
+        (unsigned char)std::lround(blue * 255.f)
+    );
+}
+
+void Colorizer::setCutoff(float cutoff)
+{
+    m_cutoff = cutoff;
+}
+
+void Colorizer::colorize(const float* depth, size_t count, unsigned char* rgb) const
+{
+    colorizeAll<3>(depth, count, rgb);
+}
+
+void Colorizer::colorizeRgba(const float* depth, size_t count, unsigned char* rgba) const
+{
+    colorizeAll<4>(depth, count, rgba);
+}
+
+void Colorizer::colorizeScalar(const float* depth, size_t count, unsigned char* rgb) const
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t color = colorizeOne(depth[i]);
+        memcpy(rgb + i * 3, &color, 3);
+    }
+}
+
+uint32_t Colorizer::colorizeOne(float depth) const
+{
+    // Written so NaN also gets the background
+    if (!(depth <= m_cutoff))
+        return m_background;
+
+    // GL_REPEAT
+    float u = depth * m_inversePeriod;
+    u -= std::floor(u);
+
+    // GL_LINEAR: texel centers sit at (i + 0.5) / size
+    float x = u * m_paletteSize - 0.5f;
+    float x0 = std::floor(x);
+
+    // 8 bits of weight, like the texture units
+    uint32_t weight = (uint32_t)((x - x0) * 256.f + 0.5f);
+
+    int first = (int)x0;
+    if (first < 0) first += m_paletteSize;
+
+    uint64_t pair = m_table[first];
+    uint32_t a = (uint32_t)pair;
+    uint32_t b = (uint32_t)(pair >> 32);
+
+    uint32_t color = 0xFFu << 24;
+    for (int channel = 0; channel < 3; ++channel) {
+        int shift = channel * 8;
+        uint32_t from = (a >> shift) & 0xFF;
+        uint32_t to = (b >> shift) & 0xFF;
+        uint32_t value = (from * (256 - weight) + to * weight + 128) >> 8;
+        color |= value << shift;
+    }
+    return color;
+}
+
+#ifdef COLORIZER_SSE2
+// SSE2 has no floor, truncation rounds negative values the wrong way
+static inline __m128 floorPs(__m128 x)
+{
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    __m128 correction = _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.f));
+    return _mm_sub_ps(truncated, correction);
+}
+
+// Blends two pixels of 16-bit channels, weights are 0 to 256 per channel.
+// The sum is at most 255 * 256, so it fits unsigned 16-bit lanes.
+static inline __m128i lerpPixels(__m128i a, __m128i b, __m128i weights)
+{
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(256), weights);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, inverse), _mm_mullo_epi16(b, weights));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+#endif
+
+template <int CHANNELS>
+void Colorizer::colorizeAll(const float* depth, size_t count, unsigned char* output) const
+{
+    size_t i = 0;
+
+#ifdef COLORIZER_SSE2
+    const __m128 cutoff = _mm_set1_ps(m_cutoff);
+    const __m128 inversePeriod = _mm_set1_ps(m_inversePeriod);
+    const __m128 size = _mm_set1_ps((float)m_paletteSize);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 weightScale = _mm_set1_ps(256.f);
+    const __m128i sizeInt = _mm_set1_epi32(m_paletteSize);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i background = _mm_set1_epi32((int)m_background);
+    const uint64_t* table = m_table.data();
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 d = _mm_loadu_ps(depth + i);
+        __m128i isBackground = _mm_castps_si128(_mm_cmpnle_ps(d, cutoff));
+
+        // Same steps as colorizeOne(), four values at a time
+        __m128 u = _mm_mul_ps(d, inversePeriod);
+        u = _mm_sub_ps(u, floorPs(u));
+
+        __m128 x = _mm_sub_ps(_mm_mul_ps(u, size), half);
+        __m128 x0 = floorPs(x);
+        __m128i weights = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(x, x0), weightScale), half));
+
+        __m128i first = _mm_cvttps_epi32(x0);
+        first = _mm_add_epi32(first, _mm_and_si128(_mm_cmplt_epi32(first, zero), sizeInt));
+        // Background lanes may hold anything, keep their lookups in range
+        first = _mm_andnot_si128(isBackground, first);
+
+        alignas(16) int32_t index[4];
+        _mm_store_si128((__m128i*)index, first);
+
+        // No gather in SSE2, but each entry holds both colors to blend
+        __m128i pair01 = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*)(table + index[0])),
+            _mm_loadl_epi64((const __m128i*)(table + index[1])));
+        __m128i pair23 = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i*)(table + index[2])),
+            _mm_loadl_epi64((const __m128i*)(table + index[3])));
+
+        __m128i a = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(pair01), _mm_castsi128_ps(pair23), _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i b = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(pair01), _mm_castsi128_ps(pair23), _MM_SHUFFLE(3, 1, 3, 1)));
+
+        // Each pixel's weight repeated over its four 16-bit channels
+        __m128i weights16 = _mm_packs_epi32(weights, weights);
+        weights16 = _mm_unpacklo_epi16(weights16, weights16);
+        __m128i weightsLow = _mm_unpacklo_epi32(weights16, weights16);
+        __m128i weightsHigh = _mm_unpackhi_epi32(weights16, weights16);
+
+        __m128i low = lerpPixels(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), weightsLow);
+        __m128i high = lerpPixels(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), weightsHigh);
+
+        __m128i colors = _mm_packus_epi16(low, high);
+        colors = _mm_or_si128(_mm_and_si128(isBackground, background), _mm_andnot_si128(isBackground, colors));
+
+        if (CHANNELS == 4) {
+            _mm_storeu_si128((__m128i*)(output + i * 4), colors);
+        }
+        else {
+            alignas(16) unsigned char packed[16];
+            _mm_store_si128((__m128i*)packed, colors);
+
+            unsigned char* out = output + i * 3;
+            memcpy(out, packed, 3);
+            memcpy(out + 3, packed + 4, 3);
+            memcpy(out + 6, packed + 8, 3);
+            memcpy(out + 9, packed + 12, 3);
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        uint32_t color = colorizeOne(depth[i]);
+        memcpy(output + i * CHANNELS, &color, CHANNELS);
+    }
+}
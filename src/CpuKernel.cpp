@@ -0,0 +1,345 @@
+#include "CpuKernel.h"
+
+#include "TileCost.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// Turns the escaping point into a smoothed iteration count
+static float smooth(int i, double x, double y, int maxIt)
+{
+    double iteration = i;
+
+    // Used to vaoid floating point issues with points inside the set.
+    if (iteration < maxIt) {
+        // sqrt of inner term remove using log simplification rules.
+        double log_zn = log(x*x + y*y) / 2;
+        double nu = log(log_zn / log(2)) / log(2);
+        // Rearranging the potential function.
+        // Dividing log_zn by log(2) instead of log(N = 1<<8)
+        // because we want the entire palette to range from the
+        // center to radius 2, NOT our bailout radius.
+        iteration = iteration + 1 - nu;
+    }
+    else {
+        // No need to change iteration -> shader will do the actual gating
+        // Plus, anisotropic filtering will work better if it isn't an extreme value
+    }
+
+    //return (i == maxIt) ? (FLT_MAX) : i / 1.f;
+    return (float)iteration;
+}
+
+static float renderPointScalar(double x0, double y0, int maxIt)
+{
+    double x = 0;
+    double y = 0;
+
+    // Source: https://en.wikipedia.org/wiki/Mandelbrot_set#Continuous_(smooth)_coloring
+    // Here N=2^8 is chosen as a reasonable bailout radius
+    int i = 0;
+    while (x*x + y*y < (1 << 16) && i < maxIt) {
+        double xtemp = x*x - y*y + x0;
+        y = 2 * x*y + y0;
+        x = xtemp;
+
+        ++i;
+    }
+
+    return smooth(i, x, y, maxIt);
+}
+
+// Renders every step-th pixel of a row, from firstPx on
+static void renderRowScalar(const Tile::Bounds& bounds, int width, int height, int py, int firstPx, int step, float* row)
+{
+    int maxIt = (int)bounds.maxIt;
+
+    for (int px = firstPx; px < width; px += step) {
+
+        double x0 = bounds.left + (px * (bounds.right - bounds.left)) / width;
+        double y0 = bounds.top + (py * (bounds.bottom - bounds.top)) / height;
+
+        row[px] = renderPointScalar(x0, y0, maxIt);
+    }
+}
+
+#ifdef CPU_KERNEL_SSE2
+static inline __m128d select(__m128d mask, __m128d a, __m128d b)
+{
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+// The same arithmetic as renderRowScalar, in the same order, so every lane
+// ends on the same bits. Two registers are in flight, since one alone
+// spends most of its time waiting on multiply latency.
+static void renderRowSse2(const Tile::Bounds& bounds, int width, int height, int py, int firstPx, int step, float* row)
+{
+    int maxIt = (int)bounds.maxIt;
+    double y0 = bounds.top + (py * (bounds.bottom - bounds.top)) / height;
+
+    const __m128d bailout = _mm_set1_pd(1 << 16);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d cy = _mm_set1_pd(y0);
+
+    int px = firstPx;
+    for (; px + 3 * step < width; px += 4 * step) {
+        double x0[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            x0[lane] = bounds.left + ((px + lane * step) * (bounds.right - bounds.left)) / width;
+        }
+
+        __m128d cxA = _mm_loadu_pd(x0);
+        __m128d cxB = _mm_loadu_pd(x0 + 2);
+        __m128d xA = _mm_setzero_pd(), yA = _mm_setzero_pd(), countA = _mm_setzero_pd();
+        __m128d xB = _mm_setzero_pd(), yB = _mm_setzero_pd(), countB = _mm_setzero_pd();
+
+        for (int i = 0; i < maxIt; ++i) {
+            __m128d xxA = _mm_mul_pd(xA, xA), yyA = _mm_mul_pd(yA, yA);
+            __m128d xxB = _mm_mul_pd(xB, xB), yyB = _mm_mul_pd(yB, yB);
+
+            __m128d activeA = _mm_cmplt_pd(_mm_add_pd(xxA, yyA), bailout);
+            __m128d activeB = _mm_cmplt_pd(_mm_add_pd(xxB, yyB), bailout);
+            if (_mm_movemask_pd(_mm_or_pd(activeA, activeB)) == 0) break;
+
+            __m128d nextXA = _mm_add_pd(_mm_sub_pd(xxA, yyA), cxA);
+            __m128d nextYA = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, xA), yA), cy);
+            __m128d nextXB = _mm_add_pd(_mm_sub_pd(xxB, yyB), cxB);
+            __m128d nextYB = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, xB), yB), cy);
+
+            // Escaped lanes keep the point they escaped with, for smoothing
+            xA = select(activeA, nextXA, xA);
+            yA = select(activeA, nextYA, yA);
+            xB = select(activeB, nextXB, xB);
+            yB = select(activeB, nextYB, yB);
+            countA = _mm_add_pd(countA, _mm_and_pd(activeA, one));
+            countB = _mm_add_pd(countB, _mm_and_pd(activeB, one));
+        }
+
+        double x[4], y[4], count[4];
+        _mm_storeu_pd(x, xA);
+        _mm_storeu_pd(x + 2, xB);
+        _mm_storeu_pd(y, yA);
+        _mm_storeu_pd(y + 2, yB);
+        _mm_storeu_pd(count, countA);
+        _mm_storeu_pd(count + 2, countB);
+
+        for (int lane = 0; lane < 4; ++lane) {
+            row[px + lane * step] = smooth((int)count[lane], x[lane], y[lane], maxIt);
+        }
+    }
+
+    renderRowScalar(bounds, width, height, py, px, step, row);
+}
+#endif
+
+static void renderRow(const Tile::Bounds& bounds, int width, int height, int py, float* row, CpuKernel::Variant variant,
+    int firstPx = 0, int step = 1)
+{
+#ifdef CPU_KERNEL_SSE2
+    if (variant == CpuKernel::Variant::SSE2) {
+        renderRowSse2(bounds, width, height, py, firstPx, step, row);
+        return;
+    }
+#endif
+
+    renderRowScalar(bounds, width, height, py, firstPx, step, row);
+}
+
+void CpuKernel::runOnEveryCore(const std::function<void()>& worker)
+{
+    unsigned threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+CpuKernel::Variant CpuKernel::getDefaultVariant()
+{
+    return isSupported(Variant::SSE2) ? Variant::SSE2 : Variant::SCALAR;
+}
+
+bool CpuKernel::isSupported(Variant variant)
+{
+#ifdef CPU_KERNEL_SSE2
+    (void)variant;
+    return true;
+#else
+    return variant == Variant::SCALAR;
+#endif
+}
+
+const char* CpuKernel::getVariantName(Variant variant)
+{
+    switch (variant) {
+    case Variant::SCALAR: return "scalar";
+    case Variant::SSE2: return "sse2";
+    }
+    return "unknown";
+}
+
+bool CpuKernel::isBorderInterior(const Tile::Bounds& bounds, int width, int height, const std::atomic<bool>* cancel)
+{
+    assert(width > 1 && height > 1);
+
+    int maxIt = (int)bounds.maxIt;
+
+    // Top and bottom rows, then the columns between them
+    int rowPixels = 2 * width;
+    int outline = rowPixels + 2 * (height - 2);
+
+    // Chunks are handed out like rows in renderRows()
+    const int CHUNK = 64;
+    std::atomic<int> nextChunk(0);
+    std::atomic<bool> escaped(false);
+
+    auto stopped = [&]() { return escaped || (cancel != nullptr && *cancel); };
+
+    auto worker = [&]() {
+        for (int first = nextChunk++ * CHUNK; first < outline && !stopped(); first = nextChunk++ * CHUNK) {
+            for (int index = first; index < std::min(first + CHUNK, outline) && !stopped(); ++index) {
+                int px, py;
+                if (index < rowPixels) {
+                    px = index % width;
+                    py = index < width ? 0 : height - 1;
+                }
+                else {
+                    px = (index - rowPixels) % 2 == 0 ? 0 : width - 1;
+                    py = 1 + (index - rowPixels) / 2;
+                }
+
+                // The same mapping as renderRowScalar()
+                double x0 = bounds.left + (px * (bounds.right - bounds.left)) / width;
+                double y0 = bounds.top + (py * (bounds.bottom - bounds.top)) / height;
+
+                if (renderPointScalar(x0, y0, maxIt) < maxIt) escaped = true;
+            }
+        }
+    };
+
+    runOnEveryCore(worker);
+
+    return !stopped();
+}
+
+float CpuKernel::renderPoint(double x, double y, float maxIt)
+{
+    return renderPointScalar(x, y, (int)maxIt);
+}
+
+double CpuKernel::countIterations(const float* values, size_t count, float maxIt)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        total += getIterations(values[i], maxIt);
+    }
+    return total;
+}
+
+void CpuKernel::render(const Tile::Bounds& bounds, int width, int height, float* buffer, Variant variant, TileCost* cost)
+{
+    renderRows(bounds, width, height, 0, height, buffer, variant, cost);
+}
+
+void CpuKernel::renderRows(const Tile::Bounds& bounds, int width, int height, int firstRow, int rows, float* buffer, Variant variant, TileCost* cost)
+{
+    assert(isSupported(variant));
+
+    // Rows are handed out one at a time, because rows through the set take
+    // far longer than rows outside of it
+    std::atomic<int> nextRow(0);
+    std::mutex costMutex;
+
+    auto worker = [&]() {
+        std::unique_ptr<TileCost> partial;
+        if (cost != nullptr) {
+            partial.reset(new TileCost(width, height, bounds.maxIt));
+        }
+
+        for (int row = nextRow++; row < rows; row = nextRow++) {
+            float* output = buffer + (size_t)row * width;
+            renderRow(bounds, width, height, firstRow + row, output, variant);
+
+            if (partial) {
+                partial->addRows(output, firstRow + row, 1);
+            }
+        }
+
+        if (partial) {
+            std::lock_guard<std::mutex> lock(costMutex);
+            cost->merge(*partial);
+        }
+    };
+
+    runOnEveryCore(worker);
+}
+
+bool CpuKernel::renderPass(const Tile::Bounds& bounds, int width, int height, int stride, bool firstPass, float* buffer, Variant variant, TileCost* cost,
+    const std::atomic<bool>* cancel)
+{
+    assert(isSupported(variant));
+    assert(stride >= 1);
+    assert(cost == nullptr || stride == 1);
+
+    int rows = (height + stride - 1) / stride;
+
+    // Handed out one at a time, like in renderRows()
+    std::atomic<int> nextRow(0);
+    std::mutex costMutex;
+
+    auto worker = [&]() {
+        std::unique_ptr<TileCost> partial;
+        if (cost != nullptr) {
+            partial.reset(new TileCost(width, height, bounds.maxIt));
+        }
+
+        for (int row = nextRow++; row < rows; row = nextRow++) {
+            if (cancel != nullptr && *cancel) break;
+
+            int y = row * stride;
+            float* output = buffer + (size_t)y * width;
+
+            // The previous pass did every other pixel of every other row
+            if (!firstPass && y % (2 * stride) == 0) {
+                renderRow(bounds, width, height, y, output, variant, stride, 2 * stride);
+            }
+            else {
+                renderRow(bounds, width, height, y, output, variant, 0, stride);
+            }
+
+            // Rows are complete after the last pass
+            if (partial) {
+                partial->addRows(output, y, 1);
+            }
+        }
+
+        if (partial) {
+            std::lock_guard<std::mutex> lock(costMutex);
+            cost->merge(*partial);
+        }
+    };
+
+    runOnEveryCore(worker);
+
+    return cancel == nullptr || !*cancel;
+}
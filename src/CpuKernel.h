@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Tile.h"
+
+#include <atomic>
+#include <functional>
+#include <math.h>
+#include <stddef.h>
+
+class TileCost;
+
+// The escape-time computation behind CpuRenderer, free of any GL so tools
+// without a display can use it too.
+class CpuKernel {
+public:
+    enum class Variant {
+        SCALAR,     // One pixel at a time
+        SSE2,       // Four pixels at a time, in two registers of two doubles
+    };
+
+    // Every variant produces the same values, so this only affects speed
+    static Variant getDefaultVariant();
+    static bool isSupported(Variant variant);
+    static const char* getVariantName(Variant variant);
+
+    // Fills buffer (width * height floats) with smoothed iteration counts,
+    // using every core. Row 0 is bounds.top.
+    // Adds the rendered pixels to cost, if given, while they are still in
+    // cache: each thread measures its own rows, merged when all are done.
+    static void render(const Tile::Bounds& bounds, int width, int height, float* buffer,
+        Variant variant = getDefaultVariant(), TileCost* cost = nullptr);
+
+    // Same, but only rows [firstRow, firstRow + rows) of the width * height
+    // image, so buffer holds width * rows floats. Pixels come out identical
+    // to a full render.
+    static void renderRows(const Tile::Bounds& bounds, int width, int height, int firstRow, int rows, float* buffer,
+        Variant variant = getDefaultVariant(), TileCost* cost = nullptr);
+
+    // One pass of a progressive render into buffer (width * height floats):
+    // fills in every stride-th pixel of every stride-th row, except those
+    // the previous pass, at twice the stride, already did. The first pass
+    // does its whole grid. Passes at any strides which halve down to 1 end
+    // with the same pixels as render(). Only the last pass, at stride 1, can
+    // measure cost, since only then are rows complete.
+    // Once cancel, if given, is set, the threads stop after their current
+    // row. Returns false if the pass was cut short that way.
+    static bool renderPass(const Tile::Bounds& bounds, int width, int height, int stride, bool firstPass, float* buffer,
+        Variant variant = getDefaultVariant(), TileCost* cost = nullptr, const std::atomic<bool>* cancel = nullptr);
+
+    // The value render() would give a pixel at x, y in the plane, for
+    // sampling between pixels
+    static float renderPoint(double x, double y, float maxIt);
+
+    // Runs worker on this thread and one more per remaining core, returning
+    // once all of them have. Workers share the work through atomics.
+    static void runOnEveryCore(const std::function<void()>& worker);
+
+    // True if every pixel on the outline of a width x height render reaches
+    // maxIt. The set is connected and has no holes, so then the whole tile
+    // is interior, as far as sampling at that resolution can tell. Stops at
+    // the first pixel which escapes, using every core. Gives up, returning
+    // false, once cancel is set, if given.
+    static bool isBorderInterior(const Tile::Bounds& bounds, int width, int height, const std::atomic<bool>* cancel = nullptr);
+
+    // Iterations it took to produce one rendered value. The bailout radius
+    // is 2^8, so an escaped point's smoothed count is 2 to 3 below them.
+    static double getIterations(float value, float maxIt)
+    {
+        return value >= maxIt ? maxIt : floor(value) + 3.0;
+    }
+
+    // Iterations it took to produce count rendered values
+    static double countIterations(const float* values, size_t count, float maxIt);
+};
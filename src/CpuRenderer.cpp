@@ -1,79 +1,239 @@
 #include "CpuRenderer.h"
 
-#include <cmath>
+#include "CpuKernel.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
 
 #include <GL/glew.h>
 
-void CpuRenderer::render(Tile & tile)
+CpuRenderer::CpuRenderer() :
+    m_stopping(false),
+    m_pendingCount(0),
+    m_pendingChecks(0)
 {
-    int width = tile.getTextureSize();
-    int height = tile.getTextureSize();
+    m_worker = std::thread(&CpuRenderer::workerLoop, this);
+}
 
-    auto buffer = new float[width * height];
+CpuRenderer::~CpuRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_worker.join();
+}
 
-    Tile::Bounds bounds = tile.getBounds();
-    int maxIt = bounds.maxIt;
-    
-    // Render the fractal
-    for (unsigned py = 0; py < height; ++py) {
-        for (unsigned px = 0; px < width; ++px) {
+std::string CpuRenderer::getName() const
+{
+    return "CPU (" + std::to_string(std::thread::hardware_concurrency()) + " threads)";
+}
 
-            double x0 = bounds.left + (px * (bounds.right - bounds.left)) / width;
-            double y0 = bounds.top + (py * (bounds.bottom - bounds.top)) / height;
+void CpuRenderer::render(Tile* tile)
+{
+    Trace::Span span("enqueue", tile->getId(), tile->getGeneration());
 
-            double x = 0;
-            double y = 0;
+    tile->setRendering();
 
-            // Source: https://en.wikipedia.org/wiki/Mandelbrot_set#Continuous_(smooth)_coloring
-            // Here N=2^8 is chosen as a reasonable bailout radius
-            int i = 0;
-            while (x*x + y*y < (1 << 16) && i < maxIt) {
-                double xtemp = x*x - y*y + x0;
-                y = 2 * x*y + y0;
-                x = xtemp;
+    std::unique_ptr<Job> job(new Job);
+    job->tile = tile;
+    job->bounds = tile->getBounds();
+    job->size = tile->getTextureSize();
+    job->seconds = 0.0;
+    job->previewStride = 0;
 
-                ++i;
-            }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued.push_back(std::move(job));
+        ++m_pendingCount;
+    }
+    m_wakeUp.notify_one();
+}
+
+std::vector<RenderBackend::CompletedRender> CpuRenderer::checkPendingRenders()
+{
+    struct Preview {
+        Job* job;
+        std::unique_ptr<float[]> samples;
+        int stride;
+    };
+
+    std::vector<std::unique_ptr<Job>> finished;
+    std::vector<Preview> previews;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        finished.swap(m_finished);
+        m_pendingCount -= (int)finished.size();
+
+        // Taken out, so the worker can copy the next pass meanwhile. Jobs
+        // only finish after their previews are withdrawn, so these live on.
+        for (auto job : m_previews) {
+            previews.push_back({ job, std::move(job->preview), job->previewStride });
+            job->previewStride = 0;
+        }
+        m_previews.clear();
+    }
+
+    for (const auto& preview : previews) {
+        uploadPreview(*preview.job, preview.samples.get(), preview.stride);
+        preview.job->tile->setPreview(preview.stride);
+    }
+
+    std::vector<CompletedRender> completed;
+
+    for (auto& job : finished) {
+        upload(*job);
+
+        job->tile->setRendered();
+        job->tile->setCost(job->cost);
+        completed.push_back({ job->tile, job->seconds, job->cost->getTotalIterations() });
+    }
+
+    return completed;
+}
+
+int CpuRenderer::getPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pendingCount;
+}
+
+void CpuRenderer::checkBorder(Tile* tile)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedChecks.push_back({ tile, tile->getBounds(), tile->getTextureSize() });
+        ++m_pendingChecks;
+    }
+    m_wakeUp.notify_one();
+}
+
+std::vector<CpuRenderer::BorderCheck> CpuRenderer::checkFinishedBorders()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<BorderCheck> finished;
+    finished.swap(m_finishedChecks);
+    m_pendingChecks -= (int)finished.size();
+    return finished;
+}
+
+int CpuRenderer::getPendingBorderCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pendingChecks;
+}
 
-            double iteration = i;
-
-            // Used to vaoid floating point issues with points inside the set.
-            if (iteration < maxIt) {
-                // sqrt of inner term remove using log simplification rules.
-                double log_zn = log(x*x + y*y) / 2;
-                double nu = log(log_zn / log(2)) / log(2);
-                // Rearranging the potential function.
-                // Dividing log_zn by log(2) instead of log(N = 1<<8)
-                // because we want the entire palette to range from the 
-                // center to radius 2, NOT our bailout radius.
-                iteration = iteration + 1 - nu;
+void CpuRenderer::workerLoop()
+{
+    Trace::setThreadName("CPU renderer");
+
+    while (true) {
+        std::unique_ptr<Job> job;
+        QueuedCheck check{};
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeUp.wait(lock, [this]() { return m_stopping || !m_queued.empty() || !m_queuedChecks.empty(); });
+
+            if (m_stopping) return;
+
+            // Checks go first, their tiles wait on them to be queued at all
+            if (!m_queuedChecks.empty()) {
+                check = m_queuedChecks.front();
+                m_queuedChecks.pop_front();
             }
             else {
-                // No need to change iteration -> shader will do the actual gating
-                // Plus, anisotropic filtering will work better if it isn't an extreme value
+                job = std::move(m_queued.front());
+                m_queued.pop_front();
             }
+        }
 
-            //buffer[py * width + px] = (i == maxIt) ? (FLT_MAX) : i / 1.f;
-            buffer[py * width + px] = (float)iteration;
+        if (check.tile != nullptr) {
+            bool interior;
+            {
+                Trace::Span span("borderCheck", check.tile->getId(), check.tile->getGeneration());
+                interior = CpuKernel::isBorderInterior(check.bounds, check.size, check.size, &m_stopping);
+            }
+            if (m_stopping) return;
 
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finishedChecks.push_back({ check.tile, interior });
+            continue;
+        }
+
+        job->buffer.reset(new float[(size_t)job->size * job->size]);
+        job->cost = std::make_shared<TileCost>(job->size, job->size, job->bounds.maxIt);
+
+        for (int stride = FIRST_STRIDE; ; stride /= 2) {
+            auto start = std::chrono::steady_clock::now();
+            {
+                Trace::Span span("cpuKernel", job->tile->getId(), job->tile->getGeneration());
+
+                TileCost* cost = stride == 1 ? job->cost.get() : nullptr;
+                if (!CpuKernel::renderPass(job->bounds, job->size, job->size, stride, stride == FIRST_STRIDE, job->buffer.get(),
+                        CpuKernel::getDefaultVariant(), cost, &m_stopping)) {
+                    // Shutting down, the job's preview goes with it
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_previews.erase(std::remove(m_previews.begin(), m_previews.end(), job.get()), m_previews.end());
+                    return;
+                }
+                if (cost) span.setIterations(cost->getTotalIterations());
+            }
+
+            // The samples of this pass, as the shader reads them
+            std::unique_ptr<float[]> preview;
+            if (stride > 1) {
+                int packedSize = job->size / stride;
+                preview.reset(new float[(size_t)packedSize * packedSize]);
+                for (int y = 0; y < packedSize; ++y) {
+                    const float* row = job->buffer.get() + (size_t)y * stride * job->size;
+                    float* packed = preview.get() + (size_t)y * packedSize;
+                    for (int x = 0; x < packedSize; ++x) {
+                        packed[x] = row[x * stride];
+                    }
+                }
+            }
+            job->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (stride == 1) break;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (job->previewStride == 0) {
+                m_previews.push_back(job.get());
+            }
+            job->preview = std::move(preview);
+            job->previewStride = stride;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // The final upload supersedes a preview still waiting
+            m_previews.erase(std::remove(m_previews.begin(), m_previews.end(), job.get()), m_previews.end());
+            job->preview.reset();
+            job->previewStride = 0;
+            m_finished.push_back(std::move(job));
         }
     }
+}
 
-    glBindTexture(GL_TEXTURE_2D, tile.getTexture());
+void CpuRenderer::upload(const Job& job)
+{
+    Trace::Span span("upload", job.tile->getId(), job.tile->getGeneration());
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, buffer);
-    delete[] buffer;
-    
-    // Not sure about this stuff
-    // ... nice trilinear filtering ...
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);  // This can't be GL_NEAREST_MIPMAP_*, but what about GL_LINEAR?
-    // ... which requires mipmaps. Generate them automatically.
-    //glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, job.tile->getTexture());
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, job.tile->getTextureLayer(), job.size, job.size, 1, GL_RED, GL_FLOAT, job.buffer.get());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void CpuRenderer::uploadPreview(const Job& job, const float* preview, int stride)
+{
+    Trace::Span span("upload", job.tile->getId(), job.tile->getGeneration());
 
+    int packedSize = job.size / stride;
 
-    // Unbind the texture? Is this needed?
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, job.tile->getTexture());
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, job.tile->getTextureLayer(), packedSize, packedSize, 1, GL_RED, GL_FLOAT, preview);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
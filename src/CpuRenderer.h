@@ -1,12 +1,99 @@
 #pragma once
 
 #include "Tile.h"
+#include "RenderBackend.h"
+#include "TileCost.h"
 
-class CpuRenderer {
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Renders tiles on a background thread, using every core for each tile.
+// The results are uploaded to the textures in checkPendingRenders(), which
+// must be called on the thread owning the GL context.
+//
+// Tiles are rendered progressively, in passes from FIRST_STRIDE down to 1,
+// so a new tile shows something after a small part of the work. The worker
+// copies each pass's samples aside and goes straight on with the next one,
+// while the main thread uploads the copy. A pass it hasn't picked up yet is
+// replaced by the next.
+//
+// The same thread checks whether new tiles are inside the set, ahead of
+// any render, so neither the checks nor the renders stall a frame.
+class CpuRenderer : public RenderBackend {
 public:
-    CpuRenderer() = default;
+    CpuRenderer();
+    virtual ~CpuRenderer();
+
+    std::string getName() const override;
+
+    void render(Tile* tile) override;
+
+    std::vector<CompletedRender> checkPendingRenders() override;
+
+    int getPendingCount() const override;
+
+    struct BorderCheck {
+        Tile* tile;
+        bool interior;
+    };
+
+    // Runs CpuKernel::isBorderInterior() on the tile's bounds at its texture
+    // size. The tile must stay alive until the result is collected.
+    void checkBorder(Tile* tile);
 
-    void render(Tile& tile);
+    // Returns the checks which finished since the last call
+    std::vector<BorderCheck> checkFinishedBorders();
+
+    // Checks passed to checkBorder() which haven't been collected yet
+    int getPendingBorderCount() const;
 
 private:
-};
\ No newline at end of file
+    // Samples 1/64 of the pixels in the first pass
+    static const int FIRST_STRIDE = 8;
+
+    struct Job {
+        Tile* tile;
+        Tile::Bounds bounds;
+        int size;
+        std::unique_ptr<float[]> buffer;
+        double seconds;
+        std::shared_ptr<TileCost> cost;
+        // The last pass's samples, packed, waiting to be uploaded. Guarded
+        // by m_mutex, previewStride is 0 once they have been.
+        std::unique_ptr<float[]> preview;
+        int previewStride;
+    };
+
+    std::thread m_worker;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    // Also read without the lock by the kernel's threads, which drop the
+    // tile they are on
+    std::atomic<bool> m_stopping;
+
+    std::deque<std::unique_ptr<Job>> m_queued;
+    std::vector<std::unique_ptr<Job>> m_finished;
+    // Jobs with a preview waiting, all of them still rendering
+    std::vector<Job*> m_previews;
+    int m_pendingCount;
+
+    struct QueuedCheck {
+        Tile* tile;
+        Tile::Bounds bounds;
+        int size;
+    };
+    std::deque<QueuedCheck> m_queuedChecks;
+    std::vector<BorderCheck> m_finishedChecks;
+    int m_pendingChecks;
+
+    void workerLoop();
+
+    // Copies the job's finished buffer to its tile's layer
+    void upload(const Job& job);
+    // Copies a packed preview to the top left of the tile's layer
+    void uploadPreview(const Job& job, const float* preview, int stride);
+};
@@ -0,0 +1,51 @@
+#include "FrameStatistics.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+
+void FrameStatistics::addFrame(double start, double seconds)
+{
+    m_frameTimes.push_back(seconds);
+    m_waiting.push_back(start);
+}
+
+void FrameStatistics::setSharp(double now)
+{
+    for (double start : m_waiting) {
+        m_timesToSharp.push_back(now - start);
+    }
+    m_waiting.clear();
+}
+
+int FrameStatistics::getFrameCount() const
+{
+    return (int)m_frameTimes.size();
+}
+
+int FrameStatistics::getUnsharpFrameCount() const
+{
+    return (int)m_waiting.size();
+}
+
+double FrameStatistics::getFrameTimePercentile(double p) const
+{
+    return percentile(m_frameTimes, p);
+}
+
+double FrameStatistics::getTimeToSharpPercentile(double p) const
+{
+    return percentile(m_timesToSharp, p);
+}
+
+double FrameStatistics::percentile(std::vector<double> values, double p)
+{
+    assert(p >= 0.0 && p <= 1.0);
+
+    if (values.empty()) return 0.0;
+
+    size_t rank = (size_t)std::ceil(p * values.size());
+    size_t index = rank == 0 ? 0 : rank - 1;
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
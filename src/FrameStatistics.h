@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+// Frame times and time-to-sharp for a replayed camera path. A frame's time
+// to sharp is how long after it started the view was next fully rendered,
+// which is what the user waits for after every move.
+class FrameStatistics {
+public:
+    FrameStatistics() = default;
+
+    // A frame which started at start, in seconds, and took seconds
+    void addFrame(double start, double seconds);
+
+    // The view is sharp at time now, ending the wait of every frame before
+    void setSharp(double now);
+
+    int getFrameCount() const;
+    // Frames the view never became sharp after
+    int getUnsharpFrameCount() const;
+
+    // p in [0, 1], by nearest rank; 0 when there are no values
+    double getFrameTimePercentile(double p) const;
+    double getTimeToSharpPercentile(double p) const;
+
+private:
+    std::vector<double> m_frameTimes;
+    std::vector<double> m_timesToSharp;
+    // Starts of the frames still waiting to be sharp
+    std::vector<double> m_waiting;
+
+    static double percentile(std::vector<double> values, double p);
+};
@@ -0,0 +1,157 @@
+#include "HeadlessContext.h"
+
+#include <GL/glew.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <stdexcept>
+#include <string.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static EGLDisplay openDisplay()
+{
+    // Surfaceless needs no X server, DRM device or GPU at all
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay != nullptr) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+            return display;
+        }
+    }
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) {
+        throw std::runtime_error("Failed to initialize EGL");
+    }
+    return display;
+}
+
+HeadlessContext::HeadlessContext(int width, int height) :
+    m_width(width),
+    m_height(height),
+    m_display(EGL_NO_DISPLAY),
+    m_context(EGL_NO_CONTEXT),
+    m_framebuffer(0),
+    m_colorBuffer(0),
+    m_depthBuffer(0)
+{
+    EGLDisplay display = openDisplay();
+    m_display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(display);
+        throw std::runtime_error("EGL does not support desktop OpenGL");
+    }
+
+    const EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        eglTerminate(display);
+        throw std::runtime_error("No EGL config supports OpenGL");
+    }
+
+    // Same version and profile as the windowed context
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        eglTerminate(display);
+        throw std::runtime_error("Failed to create an OpenGL 3.3 context through EGL");
+    }
+    m_context = context;
+
+    // Needs EGL_KHR_surfaceless_context, there is no surface to draw to
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        throw std::runtime_error("Failed to make the EGL context current");
+    }
+
+    // Initialize GLEW. With no GLX display it can only skip the GLX extensions.
+    glewExperimental = true; // Needed for core profile
+    GLenum glewResult = glewInit();
+    if (glewResult != GLEW_OK && glewResult != GLEW_ERROR_NO_GLX_DISPLAY) {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        throw std::runtime_error("Failed to initialize GLEW");
+    }
+
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_width, m_height);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Offscreen framebuffer is incomplete");
+    }
+
+    // A surfaceless context starts with an empty viewport
+    glViewport(0, 0, m_width, m_height);
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteRenderbuffers(1, &m_colorBuffer);
+    glDeleteRenderbuffers(1, &m_depthBuffer);
+
+    eglMakeCurrent((EGLDisplay)m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext((EGLDisplay)m_display, (EGLContext)m_context);
+    eglTerminate((EGLDisplay)m_display);
+}
+
+int HeadlessContext::getWidth() const
+{
+    return m_width;
+}
+
+int HeadlessContext::getHeight() const
+{
+    return m_height;
+}
+
+void HeadlessContext::readFrame(std::vector<unsigned char>& rgb) const
+{
+    size_t rowBytes = (size_t)m_width * 3;
+    rgb.resize(rowBytes * m_height);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+
+    // GL returns the bottom row first
+    std::vector<unsigned char> swap(rowBytes);
+    for (int y = 0; y < m_height / 2; ++y) {
+        unsigned char* top = rgb.data() + y * rowBytes;
+        unsigned char* bottom = rgb.data() + (m_height - 1 - y) * rowBytes;
+        memcpy(swap.data(), top, rowBytes);
+        memcpy(top, bottom, rowBytes);
+        memcpy(bottom, swap.data(), rowBytes);
+    }
+}
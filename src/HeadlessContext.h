@@ -0,0 +1,33 @@
+#pragma once
+
+typedef unsigned int GLuint;
+
+#include <vector>
+
+// An OpenGL 3.3 core context without a window, for machines with no display.
+// Created through EGL, surfaceless where Mesa supports it, so it also works
+// on llvmpipe. Everything is drawn into a framebuffer object instead.
+class HeadlessContext {
+public:
+    // Makes the context current and binds a width x height framebuffer
+    HeadlessContext(int width, int height);
+    virtual ~HeadlessContext();
+
+    int getWidth() const;
+    int getHeight() const;
+
+    // Reads back the framebuffer as tightly packed RGB rows, top row first
+    void readFrame(std::vector<unsigned char>& rgb) const;
+
+private:
+    int m_width;
+    int m_height;
+
+    // EGL handles are pointers, kept opaque so egl.h stays out of the header
+    void* m_display;
+    void* m_context;
+
+    GLuint m_framebuffer;
+    GLuint m_colorBuffer;
+    GLuint m_depthBuffer;
+};
@@ -0,0 +1,271 @@
+#include "Hud.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+
+#include <GL/glew.h>
+
+#include <common/shader.hpp>
+#include <common/text2D.hpp>
+
+#include "Tile.h"
+#include "TileSplitter.h"
+
+const std::string GRAPH_VERTEX_SHADER = R"(
+#version 330 core
+
+// In pixels, (0,0) is the bottom left corner
+layout(location = 0) in vec2 position;
+
+uniform vec2 screenSize;
+
+void main(){
+	gl_Position = vec4(position / screenSize * 2.0 - 1.0, 0, 1);
+}
+)";
+
+const std::string GRAPH_FRAGMENT_SHADER = R"(
+#version 330 core
+
+uniform vec3 lineColor;
+
+out vec3 color;
+
+void main(){
+	color = lineColor;
+}
+)";
+
+// Text layout, in pixels
+static const int TEXT_SIZE = 16;
+static const int LINE_HEIGHT = 20;
+static const int MARGIN = 10;
+static const int LINE_COUNT = 5;
+
+// The graph's scale: the top of the graph is two frames at 60 fps
+static const float GRAPH_WIDTH = 240.f;
+static const float GRAPH_HEIGHT = 80.f;
+static const float GRAPH_MAX_SECONDS = 2.f / 60.f;
+
+Hud::Hud() :
+    m_visible(false),
+    m_queriesBegun(0),
+    m_queriesRead(0),
+    m_timing(false),
+    m_gpuSeconds(0.0),
+    m_frameTimes(GRAPH_FRAMES, 0.f),
+    m_nextFrame(0),
+    m_smoothedFrameSeconds(0.0),
+    m_rateElapsed(0.0),
+    m_rateIterations(0.0),
+    m_rateBytes(0),
+    m_iterationsPerSecond(0.0),
+    m_pixelsPerSecond(0.0)
+{
+    initText2D(nullptr);
+
+    glGenQueries(QUERY_COUNT, m_queries);
+
+    m_graphProgramId = LoadShaders(GRAPH_VERTEX_SHADER, GRAPH_FRAGMENT_SHADER);
+
+    glGenVertexArrays(1, &m_graphVertexArrayId);
+    glBindVertexArray(m_graphVertexArrayId);
+
+    glGenBuffers(1, &m_graphBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_graphBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+Hud::~Hud()
+{
+    if (m_timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    glDeleteQueries(QUERY_COUNT, m_queries);
+
+    glDeleteBuffers(1, &m_graphBuffer);
+    glDeleteVertexArrays(1, &m_graphVertexArrayId);
+    glDeleteProgram(m_graphProgramId);
+
+    cleanupText2D();
+}
+
+void Hud::setVisible(bool visible)
+{
+    m_visible = visible;
+}
+
+bool Hud::isVisible() const
+{
+    return m_visible;
+}
+
+void Hud::beginGpuTimer()
+{
+    if (!m_visible || m_timing) return;
+
+    readGpuTimers();
+
+    // Every query still in flight, this frame goes untimed
+    if (m_queriesBegun - m_queriesRead >= QUERY_COUNT) return;
+
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_queriesBegun % QUERY_COUNT]);
+    m_timing = true;
+}
+
+void Hud::endGpuTimer()
+{
+    if (!m_timing) return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_timing = false;
+    ++m_queriesBegun;
+}
+
+void Hud::readGpuTimers()
+{
+    while (m_queriesRead < m_queriesBegun) {
+        GLuint query = m_queries[m_queriesRead % QUERY_COUNT];
+
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) break;
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        m_gpuSeconds = nanoseconds * 1e-9;
+
+        ++m_queriesRead;
+    }
+}
+
+void Hud::draw(double frameSeconds, const TileSplitter& splitter)
+{
+    m_frameTimes[m_nextFrame] = (float)frameSeconds;
+    m_nextFrame = (m_nextFrame + 1) % GRAPH_FRAMES;
+
+    // Steady enough to read, still follows a change within a second or so
+    m_smoothedFrameSeconds += 0.05 * (frameSeconds - m_smoothedFrameSeconds);
+
+    m_rateElapsed += frameSeconds;
+    if (m_rateElapsed >= RATE_SECONDS) {
+        double iterations = splitter.getRenderedIterations();
+        unsigned long long bytes = splitter.getRenderedBytes();
+
+        m_iterationsPerSecond = (iterations - m_rateIterations) / m_rateElapsed;
+        m_pixelsPerSecond = (bytes - m_rateBytes) / sizeof(float) / m_rateElapsed;
+
+        m_rateIterations = iterations;
+        m_rateBytes = bytes;
+        m_rateElapsed = 0.0;
+    }
+
+    if (!m_visible) return;
+
+    int queued = 0;
+    int rendering = 0;
+    int resident = 0;
+    int solid = 0;
+    int unloaded = 0;
+    for (auto tile : splitter.getTiles()) {
+        switch (tile->getState()) {
+        case Tile::State::INIT: ++queued; break;
+        case Tile::State::EMPTY:
+        case Tile::State::RENDERING: ++rendering; break;
+        case Tile::State::ACTIVE:
+        case Tile::State::SPLIT:
+            if (tile->isSolid()) ++solid;
+            else ++resident;
+            break;
+        case Tile::State::UNLOADED: ++unloaded; break;
+        }
+    }
+
+    const auto& textures = splitter.getTextures();
+    double layerMiB = (double)textures.getSize() * textures.getSize() * sizeof(float) / (1 << 20);
+    int usedLayers = textures.getLayerCount() - textures.getFreeLayerCount();
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int top = viewport[3] - MARGIN - TEXT_SIZE;
+
+    char line[128];
+    int lineNumber = 0;
+    auto print = [&]() {
+        printText2D(line, MARGIN, top - lineNumber * LINE_HEIGHT, TEXT_SIZE);
+        ++lineNumber;
+    };
+
+    snprintf(line, sizeof(line), "FPS %.1f  FRAME %.1f MS  GPU %.2f MS",
+        m_smoothedFrameSeconds > 0.0 ? 1.0 / m_smoothedFrameSeconds : 0.0, m_smoothedFrameSeconds * 1e3, m_gpuSeconds * 1e3);
+    print();
+    snprintf(line, sizeof(line), "TILES %d RESIDENT, %d SOLID, %d RENDERING, %d QUEUED, %d UNLOADED", resident, solid, rendering, queued, unloaded);
+    print();
+    // Until a backend has been measured there is nothing to go by
+    double seconds = splitter.getEstimatedSeconds();
+    if (seconds >= 0.0) {
+        snprintf(line, sizeof(line), "QUEUE DONE IN %.1f S (ESTIMATED)", seconds);
+    }
+    else {
+        snprintf(line, sizeof(line), "QUEUE DONE IN - S");
+    }
+    print();
+    snprintf(line, sizeof(line), "TILE VRAM %.0f / %.0f MIB", usedLayers * layerMiB, textures.getLayerCount() * layerMiB);
+    print();
+    snprintf(line, sizeof(line), "RENDER %.1f MPX/S  %.2f GITER/S", m_pixelsPerSecond * 1e-6, m_iterationsPerSecond * 1e-9);
+    print();
+
+    drawGraph();
+}
+
+void Hud::drawGraph()
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    float left = (float)MARGIN;
+    float bottom = (float)(viewport[3] - MARGIN - TEXT_SIZE - LINE_COUNT * LINE_HEIGHT) - GRAPH_HEIGHT;
+
+    // Oldest frame first, then the 60 fps line and the frame
+    std::vector<GLfloat> vertices;
+    for (int i = 0; i < GRAPH_FRAMES; ++i) {
+        float seconds = m_frameTimes[(m_nextFrame + i) % GRAPH_FRAMES];
+        float height = std::min(seconds / GRAPH_MAX_SECONDS, 1.f) * GRAPH_HEIGHT;
+        vertices.push_back(left + i * GRAPH_WIDTH / (GRAPH_FRAMES - 1));
+        vertices.push_back(bottom + height);
+    }
+
+    float target = bottom + GRAPH_HEIGHT / 2;
+    GLfloat guides[] = {
+        left, target, left + GRAPH_WIDTH, target,
+        left, bottom, left + GRAPH_WIDTH, bottom,
+        left, bottom + GRAPH_HEIGHT, left + GRAPH_WIDTH, bottom + GRAPH_HEIGHT,
+    };
+    vertices.insert(vertices.end(), guides, guides + sizeof(guides) / sizeof(guides[0]));
+
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(m_graphProgramId);
+    glUniform2f(glGetUniformLocation(m_graphProgramId, "screenSize"), (float)viewport[2], (float)viewport[3]);
+
+    glBindVertexArray(m_graphVertexArrayId);
+    glBindBuffer(GL_ARRAY_BUFFER, m_graphBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GLint colorId = glGetUniformLocation(m_graphProgramId, "lineColor");
+
+    glUniform3f(colorId, 0.4f, 0.4f, 0.4f);
+    glDrawArrays(GL_LINES, GRAPH_FRAMES, 6);
+
+    glUniform3f(colorId, 1.f, 1.f, 1.f);
+    glDrawArrays(GL_LINE_STRIP, 0, GRAPH_FRAMES);
+
+    if (depthTest) glEnable(GL_DEPTH_TEST);
+}
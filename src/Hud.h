@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+
+typedef unsigned int GLuint;
+
+class TileSplitter;
+
+// Performance overlay: frame rate and a frame time graph, GPU time, tiles
+// by state, tile texture memory and render throughput. Text goes through
+// common/text2D with its built-in font.
+class Hud {
+public:
+    Hud();
+    virtual ~Hud();
+
+    void setVisible(bool visible);
+    bool isVisible() const;
+
+    // Bracket the GPU work of a frame. Results are only read once they are
+    // available, a few frames later, so the timer never stalls the GPU.
+    void beginGpuTimer();
+    void endGpuTimer();
+
+    // Draws over the frame, given the time since the last one
+    void draw(double frameSeconds, const TileSplitter& splitter);
+
+private:
+    // Timer queries in flight at most
+    static const int QUERY_COUNT = 4;
+    // Frames shown in the graph
+    static const int GRAPH_FRAMES = 120;
+    // How often the throughput figures are updated
+    static constexpr double RATE_SECONDS = 0.5;
+
+    bool m_visible;
+
+    GLuint m_queries[QUERY_COUNT];
+    // Queries begun and queries read back, the difference is in flight
+    int m_queriesBegun;
+    int m_queriesRead;
+    bool m_timing;
+    double m_gpuSeconds;
+
+    std::vector<float> m_frameTimes;
+    int m_nextFrame;
+    double m_smoothedFrameSeconds;
+
+    double m_rateElapsed;
+    double m_rateIterations;
+    unsigned long long m_rateBytes;
+    double m_iterationsPerSecond;
+    double m_pixelsPerSecond;
+
+    GLuint m_graphProgramId;
+    GLuint m_graphVertexArrayId;
+    GLuint m_graphBuffer;
+
+    void readGpuTimers();
+    void drawGraph();
+};
@@ -0,0 +1,251 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+
+// Deflate stored blocks hold at most this many bytes
+static const size_t MAX_STORED_BLOCK = 65535;
+// IDAT chunks are split at this size
+static const size_t MAX_CHUNK_BYTES = 1 << 30;
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable()
+    {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+    }
+};
+
+static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    static const CrcTable table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const unsigned char* data, size_t size, uint32_t adler)
+{
+    static const uint32_t BASE = 65521;
+    // Most bytes b can take before it must be reduced to stay below 2^32
+    static const size_t NMAX = 5552;
+
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (size > 0) {
+        size_t count = std::min(size, NMAX);
+        size -= count;
+        for (size_t i = 0; i < count; ++i) {
+            a += data[i];
+            b += a;
+        }
+        data += count;
+        a %= BASE;
+        b %= BASE;
+    }
+    return (b << 16) | a;
+}
+
+static void putBigEndian(unsigned char* out, uint32_t value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+ImageWriter::Format ImageWriter::formatForPath(const std::string& path)
+{
+    auto dot = path.rfind('.');
+    if (dot != std::string::npos && path.substr(dot) == ".ppm") {
+        return Format::PPM;
+    }
+    return Format::PNG;
+}
+
+ImageWriter::ImageWriter(const std::string& path, Format format, int width, int height) :
+    m_file(nullptr),
+    m_format(format),
+    m_width(width),
+    m_height(height),
+    m_rowsWritten(0),
+    m_adler(1),
+    m_deflateRemaining((uint64_t)height * (1 + (uint64_t)width * 3)),
+    m_chunkCrc(0)
+{
+    m_file = fopen(path.c_str(), "wb");
+    if (m_file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    if (m_format == Format::PPM) {
+        fprintf(m_file, "P6\n%d %d\n255\n", m_width, m_height);
+        return;
+    }
+
+    static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    writeBytes(signature, sizeof(signature));
+
+    unsigned char header[13];
+    putBigEndian(header, (uint32_t)m_width);
+    putBigEndian(header + 4, (uint32_t)m_height);
+    header[8] = 8;      // Bit depth
+    header[9] = 2;      // Truecolor
+    header[10] = 0;     // Deflate
+    header[11] = 0;     // Adaptive filtering, only filter type 0 is used
+    header[12] = 0;     // Not interlaced
+    writeChunk("IHDR", header, sizeof(header));
+}
+
+ImageWriter::~ImageWriter()
+{
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+}
+
+void ImageWriter::writeRows(const unsigned char* rgb, int rows)
+{
+    assert(m_file != nullptr);
+    assert(m_rowsWritten + rows <= m_height);
+
+    const size_t rowBytes = (size_t)m_width * 3;
+
+    if (m_format == Format::PPM) {
+        writeBytes(rgb, rowBytes * rows);
+        m_rowsWritten += rows;
+        return;
+    }
+
+    // Every row is preceded by its filter type, then split into stored blocks
+    const size_t filteredBytes = rowBytes + 1;
+    const size_t blocksPerRow = (filteredBytes + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK;
+    const size_t rowChunkBytes = filteredBytes + 5 * blocksPerRow;
+
+    // Keep each chunk well below PNG's 2^31 byte limit
+    const int rowsPerChunk = (int)std::max<size_t>(1, MAX_CHUNK_BYTES / rowChunkBytes);
+
+    std::vector<unsigned char> row(filteredBytes);
+
+    for (int chunkRow = 0; chunkRow < rows; chunkRow += rowsPerChunk) {
+        int chunkRows = std::min(rowsPerChunk, rows - chunkRow);
+        bool first = m_rowsWritten == 0;
+
+        // Streamed straight to the file, the chunk's size is known up front
+        beginChunk("IDAT", chunkRows * rowChunkBytes + (first ? 2 : 0));
+
+        if (first) {
+            // zlib header: deflate with a 32K window, no compression, no dictionary
+            static const unsigned char zlibHeader[] = { 0x78, 0x01 };
+            writeChunkData(zlibHeader, sizeof(zlibHeader));
+        }
+
+        for (int y = chunkRow; y < chunkRow + chunkRows; ++y) {
+            row[0] = 0;
+            memcpy(row.data() + 1, rgb + y * rowBytes, rowBytes);
+            m_adler = adler32(row.data(), row.size(), m_adler);
+
+            for (size_t offset = 0; offset < row.size(); offset += MAX_STORED_BLOCK) {
+                size_t length = std::min(MAX_STORED_BLOCK, row.size() - offset);
+                m_deflateRemaining -= length;
+
+                unsigned char blockHeader[5];
+                blockHeader[0] = m_deflateRemaining == 0 ? 1 : 0;
+                blockHeader[1] = (unsigned char)length;
+                blockHeader[2] = (unsigned char)(length >> 8);
+                blockHeader[3] = (unsigned char)~length;
+                blockHeader[4] = (unsigned char)(~length >> 8);
+                writeChunkData(blockHeader, sizeof(blockHeader));
+                writeChunkData(row.data() + offset, length);
+            }
+        }
+
+        endChunk();
+        m_rowsWritten += chunkRows;
+    }
+}
+
+void ImageWriter::close()
+{
+    assert(m_file != nullptr);
+
+    if (m_rowsWritten != m_height) {
+        throw std::runtime_error("Image closed before every row was written");
+    }
+
+    if (m_format == Format::PNG) {
+        unsigned char adler[4];
+        putBigEndian(adler, m_adler);
+        writeChunk("IDAT", adler, sizeof(adler));
+        writeChunk("IEND", nullptr, 0);
+    }
+
+    bool failed = fclose(m_file) != 0;
+    m_file = nullptr;
+
+    if (failed) {
+        throw std::runtime_error("Failed to finish writing the image");
+    }
+}
+
+void ImageWriter::write(const std::string& path, int width, int height, const unsigned char* rgb)
+{
+    ImageWriter writer(path, formatForPath(path), width, height);
+    writer.writeRows(rgb, height);
+    writer.close();
+}
+
+void ImageWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+{
+    beginChunk(type, size);
+    if (size > 0) {
+        writeChunkData(data, size);
+    }
+    endChunk();
+}
+
+void ImageWriter::beginChunk(const char* type, size_t size)
+{
+    assert(size <= 0x7FFFFFFF);
+
+    unsigned char length[4];
+    putBigEndian(length, (uint32_t)size);
+    writeBytes(length, 4);
+    writeBytes(type, 4);
+
+    // The CRC covers the type and the data, not the length
+    m_chunkCrc = crc32((const unsigned char*)type, 4);
+}
+
+void ImageWriter::writeChunkData(const unsigned char* data, size_t size)
+{
+    writeBytes(data, size);
+    m_chunkCrc = crc32(data, size, m_chunkCrc);
+}
+
+void ImageWriter::endChunk()
+{
+    unsigned char crcBytes[4];
+    putBigEndian(crcBytes, m_chunkCrc);
+    writeBytes(crcBytes, 4);
+}
+
+void ImageWriter::writeBytes(const void* data, size_t size)
+{
+    if (fwrite(data, 1, size, m_file) != size) {
+        throw std::runtime_error("Failed to write the image");
+    }
+}
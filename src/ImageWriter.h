@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Writes an 8-bit RGB image to disk a band of rows at a time, so the whole
+// image never needs to be in memory. PNG output is stored uncompressed,
+// which keeps it dependency-free and as fast as the disk.
+class ImageWriter {
+public:
+    enum class Format {
+        PNG,
+        PPM,    // Binary P6
+    };
+
+    // Picks the format from the extension, PNG unless it ends in .ppm
+    static Format formatForPath(const std::string& path);
+
+    // Opens the file and writes the header, throws std::runtime_error on failure
+    ImageWriter(const std::string& path, Format format, int width, int height);
+    virtual ~ImageWriter();
+
+    // Appends rows, top first, width * 3 bytes each
+    void writeRows(const unsigned char* rgb, int rows);
+
+    // Finishes the file once every row has been written
+    void close();
+
+    // Writes a whole image in one go
+    static void write(const std::string& path, int width, int height, const unsigned char* rgb);
+
+private:
+    FILE* m_file;
+    Format m_format;
+    int m_width;
+    int m_height;
+    int m_rowsWritten;
+
+    // zlib stream state for PNG
+    uint32_t m_adler;
+    uint64_t m_deflateRemaining;
+    uint32_t m_chunkCrc;
+
+    void writeChunk(const char* type, const unsigned char* data, size_t size);
+    // For chunks too large to assemble in memory first
+    void beginChunk(const char* type, size_t size);
+    void writeChunkData(const unsigned char* data, size_t size);
+    void endChunk();
+    void writeBytes(const void* data, size_t size);
+};
@@ -0,0 +1,40 @@
+#include "IterationLimit.h"
+
+#include "TileCost.h"
+
+#include <algorithm>
+#include <math.h>
+
+float IterationLimit::forChildren(const Tile::Bounds& parent, const TileCost& cost, int childGeneration)
+{
+    double pixels = cost.getPixelCount();
+    double escaped = pixels - cost.getInteriorCount();
+
+    // Nothing escaped, so nothing says how much less would do
+    if (escaped <= 0.0) return parent.maxIt;
+
+    // Interior pixels are counted at maxIt, take them back out
+    std::vector<double> histogram = cost.getHistogram();
+    int interiorBin = cost.getMaxIt() < 2.f ? 0 : std::min(ilogb(cost.getMaxIt()), TileCost::HISTOGRAM_BINS - 1);
+    histogram[interiorBin] -= cost.getInteriorCount();
+
+    // The slowest bin holding more than the tail
+    int top = 0;
+    double tail = 0.0;
+    for (int bin = TileCost::HISTOGRAM_BINS - 1; bin >= 0; --bin) {
+        tail += histogram[bin];
+        if (tail > TAIL_FRACTION * pixels) {
+            top = bin;
+            break;
+        }
+    }
+
+    float needed = ldexpf(1.f, top + 1) * HEADROOM;
+
+    float depthFloor = MIN_ITERATIONS + ITERATIONS_PER_GENERATION * childGeneration;
+    float ceiling = std::min(MAX_ITERATIONS, std::max(parent.maxIt * GROWTH_PER_GENERATION, depthFloor));
+
+    // The kernels count in whole iterations, and compare values against maxIt
+    float limit = floorf(std::min(std::max(needed, depthFloor), ceiling));
+    return std::max(limit, parent.maxIt);
+}
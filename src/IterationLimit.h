@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Tile.h"
+
+class TileCost;
+
+// Picks the maxIt a tile's children render with, from what the parent's
+// pixels took and how deep the children are.
+//
+// Whatever escaped in the parent escapes in the children at about the same
+// count, so their limit only has to clear the slowest escapes seen, with
+// some headroom. Anything left above it shows as interior, which the
+// shader draws in the background color like every value past the cutoff.
+// Zooming in reveals slower escapes, so the limit has a floor which rises
+// with depth, and it can only grow so fast per generation. It never drops
+// below the parent's: a point which escaped there would turn interior in
+// the children, darkening filaments as the view zooms in.
+class IterationLimit {
+public:
+    static float forChildren(const Tile::Bounds& parent, const TileCost& cost, int childGeneration);
+
+private:
+    // Escaped pixels which may be above the slowest bin still counted
+    static constexpr double TAIL_FRACTION = 1e-4;
+    // Times the top of the slowest counted bin
+    static constexpr float HEADROOM = 2.f;
+
+    static constexpr float MIN_ITERATIONS = 256.f;
+    static constexpr float ITERATIONS_PER_GENERATION = 64.f;
+    static constexpr float MAX_ITERATIONS = 65536.f;
+    static constexpr float GROWTH_PER_GENERATION = 1.25f;
+};
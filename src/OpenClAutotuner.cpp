@@ -0,0 +1,192 @@
+#include "OpenClAutotuner.h"
+
+#include "ReferenceViews.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+
+const char* const OpenClAutotuner::DEFAULT_PATH = "opencl-tuning.txt";
+
+OpenClAutotuner::OpenClAutotuner(OpenClRenderer& renderer, int size, int repetitions) :
+    m_renderer(renderer),
+    m_size(size),
+    m_repetitions(repetitions)
+{
+}
+
+std::vector<OpenClRenderer::KernelConfig> OpenClAutotuner::getCandidates() const
+{
+    typedef OpenClRenderer::KernelVariant Variant;
+
+    const int localSizes2D[][2] = { { 0, 0 }, { 8, 8 }, { 16, 4 }, { 16, 16 }, { 32, 8 }, { 64, 4 }, { 256, 1 } };
+    const int vectorWidths[] = { 2, 4, 8, 16 };
+    const int groupSizes[] = { 32, 64, 128, 256 };
+
+    std::vector<OpenClRenderer::KernelConfig> candidates;
+
+    for (auto& local : localSizes2D) {
+        candidates.push_back({ Variant::SCALAR, 1, local[0], local[1] });
+    }
+    for (int width : vectorWidths) {
+        for (auto& local : localSizes2D) {
+            candidates.push_back({ Variant::VECTOR, width, local[0], local[1] });
+        }
+    }
+    for (int groupSize : groupSizes) {
+        candidates.push_back({ Variant::PERSISTENT, 1, groupSize, 1 });
+    }
+
+    return candidates;
+}
+
+OpenClAutotuner::Result OpenClAutotuner::measure(const OpenClRenderer::KernelConfig& config)
+{
+    Result result{ config, 0.0, true };
+
+    std::vector<float> output((size_t)m_size * m_size);
+    std::vector<double> times(m_repetitions);
+
+    try {
+        m_renderer.setKernelConfig(config);
+
+        for (const auto& view : getReferenceViews()) {
+            // Warm up, so the configuration isn't charged for the driver's setup
+            m_renderer.renderToHost(view.bounds, m_size, output.data());
+
+            for (auto& seconds : times) {
+                seconds = m_renderer.renderToHost(view.bounds, m_size, output.data());
+            }
+
+            std::sort(times.begin(), times.end());
+            result.seconds += times[times.size() / 2];
+        }
+    }
+    catch (const std::exception&) {
+        // Usually a work-group size the device doesn't support
+        result.valid = false;
+    }
+
+    return result;
+}
+
+std::vector<OpenClAutotuner::Result> OpenClAutotuner::run()
+{
+    auto original = m_renderer.getKernelConfig();
+
+    std::vector<Result> results;
+    for (const auto& config : getCandidates()) {
+        results.push_back(measure(config));
+    }
+
+    m_renderer.setKernelConfig(original);
+
+    // Stable, so ties keep the candidate order
+    std::stable_sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+        if (a.valid != b.valid) return a.valid;
+        return a.seconds < b.seconds;
+    });
+
+    return results;
+}
+
+void OpenClAutotuner::printTable(const std::vector<Result>& results)
+{
+    printf("%-4s %-10s %5s %9s %10s %8s\n", "rank", "kernel", "width", "local", "ms", "relative");
+
+    double best = results.empty() ? 0.0 : results[0].seconds;
+
+    int rank = 1;
+    for (const auto& result : results) {
+        const auto& config = result.config;
+
+        char local[32];
+        if (config.localWidth == 0) {
+            snprintf(local, sizeof(local), "driver");
+        }
+        else {
+            snprintf(local, sizeof(local), "%dx%d", config.localWidth, config.localHeight);
+        }
+
+        if (result.valid) {
+            printf("%-4d %-10s %5d %9s %10.2f %7.2fx\n",
+                rank++,
+                OpenClRenderer::getVariantName(config.variant),
+                config.vectorWidth,
+                local,
+                result.seconds * 1e3,
+                result.seconds / best
+            );
+        }
+        else {
+            printf("%-4s %-10s %5d %9s %10s %8s\n",
+                "-",
+                OpenClRenderer::getVariantName(config.variant),
+                config.vectorWidth,
+                local,
+                "failed",
+                ""
+            );
+        }
+    }
+}
+
+bool OpenClAutotuner::load(const std::string& path, const std::string& deviceKey, OpenClRenderer::KernelConfig& config)
+{
+    typedef OpenClRenderer::KernelVariant Variant;
+
+    std::ifstream file(path);
+    std::string line;
+
+    // One device per line: key <tab> variant vectorWidth localWidth localHeight
+    while (std::getline(file, line)) {
+        auto tab = line.find('\t');
+        if (tab == std::string::npos || line.substr(0, tab) != deviceKey) continue;
+
+        std::istringstream fields(line.substr(tab + 1));
+        std::string variantName;
+        OpenClRenderer::KernelConfig loaded;
+        if (!(fields >> variantName >> loaded.vectorWidth >> loaded.localWidth >> loaded.localHeight)) {
+            return false;
+        }
+
+        for (auto variant : { Variant::SCALAR, Variant::VECTOR, Variant::PERSISTENT }) {
+            if (variantName == OpenClRenderer::getVariantName(variant)) {
+                loaded.variant = variant;
+                config = loaded;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return false;
+}
+
+void OpenClAutotuner::save(const std::string& path, const std::string& deviceKey, const OpenClRenderer::KernelConfig& config)
+{
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.substr(0, line.find('\t')) != deviceKey) {
+                lines.push_back(line);
+            }
+        }
+    }
+
+    std::ostringstream entry;
+    entry << deviceKey << '\t'
+        << OpenClRenderer::getVariantName(config.variant) << ' '
+        << config.vectorWidth << ' '
+        << config.localWidth << ' '
+        << config.localHeight;
+    lines.push_back(entry.str());
+
+    std::ofstream file(path);
+    for (const auto& line : lines) {
+        file << line << '\n';
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "OpenClRenderer.h"
+
+#include <string>
+#include <vector>
+
+// Sweeps work-group sizes, vector widths and kernel variants on the
+// reference views, and keeps the fastest configuration for each device.
+//
+// Every configuration renders the same views in the same order, and the
+// median of several runs is kept, so repeated runs give the same ranking.
+class OpenClAutotuner {
+public:
+    struct Result {
+        OpenClRenderer::KernelConfig config;
+        double seconds;     // Sum over the reference views of the median time
+        bool valid;         // False if the device rejected the configuration
+    };
+
+    // Where OpenClRenderer looks for tuned configurations
+    static const char* const DEFAULT_PATH;
+
+    OpenClAutotuner(OpenClRenderer& renderer, int size, int repetitions);
+
+    // Tries every candidate and returns the results, fastest first
+    std::vector<Result> run();
+
+    static void printTable(const std::vector<Result>& results);
+
+    // Returns false if there is no entry for the device
+    static bool load(const std::string& path, const std::string& deviceKey, OpenClRenderer::KernelConfig& config);
+    // Replaces the device's entry, keeping the other devices
+    static void save(const std::string& path, const std::string& deviceKey, const OpenClRenderer::KernelConfig& config);
+
+private:
+    OpenClRenderer& m_renderer;
+    int m_size;
+    int m_repetitions;
+
+    std::vector<OpenClRenderer::KernelConfig> getCandidates() const;
+    Result measure(const OpenClRenderer::KernelConfig& config);
+};
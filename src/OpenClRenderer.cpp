@@ -1,40 +1,32 @@
 #include "OpenClRenderer.h"
 
+#include "OpenClAutotuner.h"
 #include "Tile.h"
+#include "Trace.h"
 
 #include <GL/glew.h>
 
 
 // For getting the GL context
-// What do if not Windows?
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <GL/glx.h>
+#endif
 
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <string.h>
 #include <iostream>
+#include <stdexcept>
 
 const static std::string kernelSourceStr = R"(
-__kernel void mandelbrotKernel(
-    __global const float *bounds,
-    //__global const int *maxIt,
-    __write_only image2d_t output
-) {
-    int width = get_image_width(output);
-    int height = get_image_height(output);
-    int2 coord = (int2) (get_global_id(0), get_global_id(1));
-
-    float left = bounds[0];
-    float right = bounds[1];
-    float top = bounds[2];
-    float bottom = bounds[3];
-    int maxIt = (int)bounds[4];
-    
-    float x0 = left + (coord.x * (right - left)) / width;
-    float y0 = top + (coord.y * (bottom - top)) / height;
-
+// Smoothed iteration count for one point
+float escapeTime(float x0, float y0, int maxIt)
+{
 	float x = 0;
 	float y = 0;
-	float xSqr;
-	float ySqr;
-	float xTemp = 0;
 
     // Source: https://en.wikipedia.org/wiki/Mandelbrot_set#Continuous_(smooth)_coloring
     // Here N=2^8 is chosen as a reasonable bailout radius
@@ -66,10 +58,410 @@ __kernel void mandelbrotKernel(
         // Plus, anisotropic filtering will work better if it isn't an extreme value
     }
 
-    write_imagef(output, coord, iteration);
+    return iteration;
+}
+
+// Per-tile statistics, reduced while rendering. Every work-item gathers its
+// own pixels privately, then the work-group combines them in a tree in
+// local memory and one work-item adds the result to the tile's totals with
+// global atomics. Only the histogram is counted with local atomics, as its
+// pixels spread over many bins. Layout in uints, as OpenClRenderer reads it:
+#define STATS_MIN 0             // Smallest value outside the set, as float bits
+#define STATS_MAX 1             // Largest value outside the set, as float bits
+#define STATS_INTERIOR 2        // Pixels which reached maxIt
+#define STATS_HISTOGRAM 3       // HISTOGRAM_BINS pixel counts, by log2 of the iterations
+#define STATS_MAP (STATS_HISTOGRAM + HISTOGRAM_BINS)   // Iterations per map cell, low and high words
+#define STATS_MAP_INTERIOR (STATS_MAP + 2 * MAP_SIZE * MAP_SIZE)   // Pixels per map cell which reached maxIt
+#define STATS_SIZE (STATS_MAP_INTERIOR + MAP_SIZE * MAP_SIZE)
+
+// One work-item's share, and after statsFlush()'s reduction the group's
+typedef struct {
+    ulong iterations;   // In the group's map cell
+    uint minBits;
+    uint maxBits;
+    uint interior;
+    uint cellInterior;  // Interior pixels in the group's map cell
+} Stats;
+
+// Entries in the reduction's local memory, 6 KB. Larger groups, which CPU
+// runtimes allow up to thousands of work-items, fold onto it in rounds.
+#define STATS_SCRATCH 256
+
+// Kernels declare these at their scope, OpenCL allows __local nowhere else
+#define STATS_LOCALS \
+    __local uint histogram[HISTOGRAM_BINS]; \
+    __local Stats scratch[STATS_SCRATCH]; \
+    Stats mine;
+
+uint localIndex()
+{
+    return get_local_id(1) * get_local_size(0) + get_local_id(0);
+}
+
+// 64 bits out of two 32-bit atomics: whoever wraps the low word carries
+void addWideGlobal(volatile __global uint *low, uint value)
+{
+    uint old = atomic_add(low, value);
+    if (old + value < old) atomic_inc(low + 1);
+}
+
+int mapCell(int x, int y, int width, int height)
+{
+    return (y * MAP_SIZE / height) * MAP_SIZE + x * MAP_SIZE / width;
+}
+
+void statsClear(__local uint *histogram, Stats *mine)
+{
+    uint count = get_local_size(0) * get_local_size(1);
+    for (uint i = localIndex(); i < HISTOGRAM_BINS; i += count) {
+        histogram[i] = 0;
+    }
+
+    mine->iterations = 0;
+    mine->minBits = as_uint(FLT_MAX);
+    mine->maxBits = 0;
+    mine->interior = 0;
+    mine->cellInterior = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// The iterations are counted the way CpuKernel::getIterations() does.
+// Values are non-negative in practice; clamping keeps the float bits in order.
+void statsAdd(__local uint *histogram, Stats *mine, __global uint *tile, float value, int maxIt, int cell, int groupCell)
+{
+    uint iterations;
+    bool interior = value >= maxIt;
+    if (interior) {
+        iterations = maxIt;
+        ++mine->interior;
+    }
+    else {
+        iterations = (uint)max(floor(value) + 3.f, 1.f);
+        uint bits = as_uint(max(value, 0.f));
+        mine->minBits = min(mine->minBits, bits);
+        mine->maxBits = max(mine->maxBits, bits);
+    }
+
+    atomic_inc(&histogram[min(31 - (int)clz(iterations), HISTOGRAM_BINS - 1)]);
+
+    // A group straddling map cells sends the other cells' pixels straight to the tile
+    if (cell == groupCell) {
+        mine->iterations += iterations;
+        if (interior) ++mine->cellInterior;
+    }
+    else {
+        addWideGlobal(&tile[STATS_MAP + 2 * cell], iterations);
+        if (interior) atomic_inc(&tile[STATS_MAP_INTERIOR + cell]);
+    }
 }
+
+void statsCombine(__local Stats *a, Stats b)
+{
+    a->iterations += b.iterations;
+    a->minBits = min(a->minBits, b.minBits);
+    a->maxBits = max(a->maxBits, b.maxBits);
+    a->interior += b.interior;
+    a->cellInterior += b.cellInterior;
+}
+
+// Combines every work-item's share, then adds the group's to the tile's
+void statsFlush(__local uint *histogram, __local Stats *scratch, Stats *mine, __global uint *tile, int groupCell)
+{
+    uint count = get_local_size(0) * get_local_size(1);
+    uint i = localIndex();
+
+    // Every round is the same for the whole group, so all reach the barriers
+    for (uint first = 0; first < count; first += STATS_SCRATCH) {
+        if (i >= first && i < first + STATS_SCRATCH) {
+            if (first == 0) scratch[i] = *mine;
+            else statsCombine(&scratch[i - first], *mine);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    count = min(count, (uint)STATS_SCRATCH);
+
+    // Folds the upper half of the live entries onto the lower half, which
+    // works for group sizes other than powers of two too
+    uint half = 1;
+    while (half * 2 < count) half *= 2;
+
+    for (; half > 0; half /= 2) {
+        if (i < half && i + half < count) {
+            statsCombine(&scratch[i], scratch[i + half]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (i == 0) {
+        Stats group = scratch[0];
+
+        atomic_min(&tile[STATS_MIN], group.minBits);
+        atomic_max(&tile[STATS_MAX], group.maxBits);
+        if (group.interior > 0) {
+            atomic_add(&tile[STATS_INTERIOR], group.interior);
+        }
+        for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
+            if (histogram[bin] > 0) {
+                atomic_add(&tile[STATS_HISTOGRAM + bin], histogram[bin]);
+            }
+        }
+        addWideGlobal(&tile[STATS_MAP + 2 * groupCell], (uint)group.iterations);
+        atomic_add(&tile[STATS_MAP + 2 * groupCell + 1], (uint)(group.iterations >> 32));
+        if (group.cellInterior > 0) {
+            atomic_add(&tile[STATS_MAP_INTERIOR + groupCell], group.cellInterior);
+        }
+    }
+
+    // The histogram and scratch may be reused for the next block right after
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+__kernel void mandelbrotKernel(
+    __global const float *bounds,
+    //__global const int *maxIt,
+    __write_only image2d_array_t output,
+    int layer,
+    __global uint *stats
+) {
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+    int2 coord = (int2) (get_global_id(0), get_global_id(1));
+
+    float left = bounds[0];
+    float right = bounds[1];
+    float top = bounds[2];
+    float bottom = bounds[3];
+    int maxIt = (int)bounds[4];
+
+    STATS_LOCALS
+    statsClear(histogram, &mine);
+    int groupCell = mapCell(get_group_id(0) * get_local_size(0), get_group_id(1) * get_local_size(1), width, height);
+
+    // The global size is rounded up to a multiple of the work-group size,
+    // the extra work-items only take part in the reduction
+    if (coord.x < width && coord.y < height) {
+        float x0 = left + (coord.x * (right - left)) / width;
+        float y0 = top + (coord.y * (bottom - top)) / height;
+
+        float value = escapeTime(x0, y0, maxIt);
+        write_imagef(output, (int4) (coord, layer, 0), value);
+        statsAdd(histogram, &mine, stats, value, maxIt, mapCell(coord.x, coord.y, width, height), groupCell);
+    }
+
+    statsFlush(histogram, scratch, &mine, stats, groupCell);
+}
+
+// Renders several tiles of the same size in one launch. The z dimension
+// picks the tile, which goes to its own layer of output.
+__kernel void mandelbrotBatchKernel(
+    __global const float *boundsTable,
+    __write_only image2d_array_t output,
+    __global const int *layerTable,
+    __global uint *statsTable
+) {
+    int size = get_image_width(output);
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int tile = get_global_id(2);
+
+    __global const float *bounds = boundsTable + tile * 5;
+    __global uint *stats = statsTable + tile * STATS_SIZE;
+
+    float left = bounds[0];
+    float right = bounds[1];
+    float top = bounds[2];
+    float bottom = bounds[3];
+    int maxIt = (int)bounds[4];
+
+    STATS_LOCALS
+    statsClear(histogram, &mine);
+    int groupCell = mapCell(get_group_id(0) * get_local_size(0), get_group_id(1) * get_local_size(1), size, size);
+
+    if (x < size && y < size) {
+        float x0 = left + (x * (right - left)) / size;
+        float y0 = top + (y * (bottom - top)) / size;
+
+        float value = escapeTime(x0, y0, maxIt);
+        write_imagef(output, (int4) (x, y, layerTable[tile], 0), value);
+        statsAdd(histogram, &mine, stats, value, maxIt, mapCell(x, y, size, size), groupCell);
+    }
+
+    statsFlush(histogram, scratch, &mine, stats, groupCell);
+}
+
+// Side of the square blocks of pixels handed out by mandelbrotPersistentKernel
+#define PERSISTENT_BLOCK 16
+
+// Launched with just enough work-groups to fill the device. Each work-group
+// keeps taking the next block of pixels from a global counter until the
+// whole image is done, so groups which got cheap exterior blocks carry on
+// with more work instead of idling while others grind through the interior.
+__kernel void mandelbrotPersistentKernel(
+    __global const float *bounds,
+    __write_only image2d_array_t output,
+    int layer,
+    __global uint *stats,
+    __global volatile int *nextBlock
+) {
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+
+    float left = bounds[0];
+    float right = bounds[1];
+    float top = bounds[2];
+    float bottom = bounds[3];
+    int maxIt = (int)bounds[4];
+
+    int blocksX = (width + PERSISTENT_BLOCK - 1) / PERSISTENT_BLOCK;
+    int blocksY = (height + PERSISTENT_BLOCK - 1) / PERSISTENT_BLOCK;
+    int blockCount = blocksX * blocksY;
+
+    __local int block;
+    STATS_LOCALS
+
+    while (true) {
+        if (get_local_id(0) == 0) {
+            block = atomic_inc(nextBlock);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        int current = block;
+        // Nobody may take the next block before everyone has read this one
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (current >= blockCount)
+            return;
+
+        int blockX = (current % blocksX) * PERSISTENT_BLOCK;
+        int blockY = (current / blocksX) * PERSISTENT_BLOCK;
+
+        // Reduced per block, a block lies in one map cell
+        statsClear(histogram, &mine);
+        int groupCell = mapCell(blockX, blockY, width, height);
+
+        for (int p = get_local_id(0); p < PERSISTENT_BLOCK * PERSISTENT_BLOCK; p += get_local_size(0)) {
+            int2 coord = (int2) (blockX + p % PERSISTENT_BLOCK, blockY + p / PERSISTENT_BLOCK);
+            if (coord.x >= width || coord.y >= height)
+                continue;
+
+            float x0 = left + (coord.x * (right - left)) / width;
+            float y0 = top + (coord.y * (bottom - top)) / height;
+
+            float value = escapeTime(x0, y0, maxIt);
+            write_imagef(output, (int4) (coord, layer, 0), value);
+            statsAdd(histogram, &mine, stats, value, maxIt, mapCell(coord.x, coord.y, width, height), groupCell);
+        }
+
+        statsFlush(histogram, scratch, &mine, stats, groupCell);
+    }
+}
+
+// VECTOR_WIDTH is defined by the host, from CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT
+#if VECTOR_WIDTH > 1
+
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+
+typedef CAT(float, VECTOR_WIDTH) floatv;
+typedef CAT(int, VECTOR_WIDTH) intv;
+#define convert_floatv CAT(convert_float, VECTOR_WIDTH)
+#define vloadv CAT(vload, VECTOR_WIDTH)
+#define vstorev CAT(vstore, VECTOR_WIDTH)
+
+// Same as mandelbrotKernel, but each work-item does VECTOR_WIDTH neighbouring
+// pixels of a row. Lanes which escape are masked off, and the loop ends once
+// every lane is done.
+__kernel void mandelbrotVectorKernel(
+    __global const float *bounds,
+    __write_only image2d_array_t output,
+    int layer,
+    __global uint *stats
+) {
+    int width = get_image_width(output);
+    int height = get_image_height(output);
+    int firstX = get_global_id(0) * VECTOR_WIDTH;
+    int py = get_global_id(1);
+
+    STATS_LOCALS
+    statsClear(histogram, &mine);
+    int groupCell = mapCell(get_group_id(0) * get_local_size(0) * VECTOR_WIDTH, get_group_id(1) * get_local_size(1), width, height);
+
+    // Past the edge, a work-item only takes part in the reduction
+    if (firstX < width && py < height) {
+        float left = bounds[0];
+        float right = bounds[1];
+        float top = bounds[2];
+        float bottom = bounds[3];
+        int maxIt = (int)bounds[4];
+
+        const float laneOffsets[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        floatv lane = vloadv(0, laneOffsets);
+
+        floatv x0 = left + ((firstX + lane) * (right - left)) / width;
+        floatv y0 = (floatv)(top + (py * (bottom - top)) / height);
+
+        floatv x = 0;
+        floatv y = 0;
+
+        // Comparisons give -1 for true lanes, so subtracting the mask counts
+        intv iterations = 0;
+        intv active = -1;
+
+        for (int i = 0; i < maxIt; ++i) {
+            active &= (x*x + y*y < (1 << 16));
+            if (!any(active))
+                break;
+
+            floatv xtemp = x*x - y*y + x0;
+            floatv ytemp = 2 * x*y + y0;
+
+            // Escaped lanes keep their last z for the smoothing below
+            x = select(x, xtemp, active);
+            y = select(y, ytemp, active);
+
+            iterations -= active;
+        }
+
+        floatv iteration = convert_floatv(iterations);
+
+        // Same smoothing as mandelbrotKernel, but only kept for lanes which escaped
+        floatv log_zn = log(x*x + y*y) / 2.f;
+        floatv nu = log(log_zn / log(2.f)) / log(2.f);
+        iteration = select(iteration + 1 - nu, iteration, iterations >= maxIt);
+
+        float values[VECTOR_WIDTH];
+        vstorev(iteration, 0, values);
+
+        for (int l = 0; l < VECTOR_WIDTH; ++l) {
+            if (firstX + l < width) {
+                write_imagef(output, (int4)(firstX + l, py, layer, 0), values[l]);
+                statsAdd(histogram, &mine, stats, values[l], maxIt, mapCell(firstX + l, py, width, height), groupCell);
+            }
+        }
+    }
+
+    statsFlush(histogram, scratch, &mine, stats, groupCell);
+}
+
+#endif
 )";
 
+// Rounds the global size up to a whole number of work-groups
+static size_t roundUp(size_t global, size_t local)
+{
+    return (global + local - 1) / local * local;
+}
+
+// Vector widths OpenCL C has a type for
+static int chooseVectorWidth(cl_uint preferred)
+{
+    if (preferred >= 16) return 16;
+    if (preferred >= 8) return 8;
+    if (preferred >= 4) return 4;
+    if (preferred >= 2) return 2;
+    return 1;
+}
+
 void myassert(cl_uint errorCode) {
     if (errorCode != CL_SUCCESS) {
         throw std::runtime_error("Assertion failed: " + std::to_string(errorCode));
@@ -81,119 +473,569 @@ void CL_CALLBACK myCallback(const char* errorinfo, const void * private_info_siz
     std::cout << message;
 }
 
-OpenClRenderer::OpenClRenderer()
+OpenClRenderer::OpenClRenderer(bool shareGlContext) :
+    m_localWidth(0),
+    m_localHeight(0),
+    m_sharedTexture(0)
 {
 
     cl_int result;
 
     std::vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
+    if (platforms.empty()) {
+        throw std::runtime_error("No OpenCL platform found");
+    }
     m_platform = platforms[0];
 
+    if (shareGlContext) {
+        // Create a context sharing the current GL context
+        cl_context_properties properties[] =
+        {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)m_platform(),
+#ifdef _WIN32
+            CL_GL_CONTEXT_KHR,   (cl_context_properties)wglGetCurrentContext(),
+            CL_WGL_HDC_KHR,      (cl_context_properties)wglGetCurrentDC(),
+#else
+            CL_GL_CONTEXT_KHR,   (cl_context_properties)glXGetCurrentContext(),
+            CL_GLX_DISPLAY_KHR,  (cl_context_properties)glXGetCurrentDisplay(),
+#endif
+            0
+        };
 
-    // Create a context
-    // What do if not Windows?
-    HGLRC hGLRC = wglGetCurrentContext();
-    HDC hDC = wglGetCurrentDC();
+        std::vector<cl::Device> devices;
+        m_platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        if (devices.empty()) {
+            throw std::runtime_error("No OpenCL GPU device found");
+        }
+        m_device = devices[0];
 
-    cl_context_properties properties[] =
-    {
-        CL_CONTEXT_PLATFORM, (cl_context_properties)m_platform(),
-        CL_GL_CONTEXT_KHR,   (cl_context_properties)hGLRC,
-        CL_WGL_HDC_KHR,      (cl_context_properties)hDC,
-        0
-    };
+        m_context = cl::Context(m_device, properties, &myCallback);
+    }
+    else {
+        // Prefer a GPU on any platform, but take whatever there is
+        const cl_device_type deviceTypes[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+
+        std::vector<cl::Device> devices;
+        for (auto deviceType : deviceTypes) {
+            for (auto& platform : platforms) {
+                std::vector<cl::Device> platformDevices;
+                try {
+                    platform.getDevices(deviceType, &platformDevices);
+                }
+                catch (const cl::Error&) {
+                    // CL_DEVICE_NOT_FOUND
+                }
+                if (!platformDevices.empty() && devices.empty()) {
+                    m_platform = platform;
+                    devices = platformDevices;
+                }
+            }
+        }
+        if (devices.empty()) {
+            throw std::runtime_error("No OpenCL device found");
+        }
+        m_device = devices[0];
 
-    std::vector<cl::Device> devices;
-    m_platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        cl_context_properties properties[] =
+        {
+            CL_CONTEXT_PLATFORM, (cl_context_properties)m_platform(),
+            0
+        };
 
-    m_context = cl::Context(devices[0], properties, &myCallback);
+        m_context = cl::Context(m_device, properties, &myCallback);
+    }
 
-    m_queue = cl::CommandQueue(m_context, devices[0], 0, &result);
+    // Profiling lets the scheduler see how long each tile really took
+    m_queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE, &result);
     myassert(result);
 
-    m_program = cl::Program(m_context, kernelSourceStr, true, &result);
-    //myassert(result);
+    m_vectorWidth = chooseVectorWidth(m_device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>());
+    m_variant = m_vectorWidth > 1 ? KernelVariant::VECTOR : KernelVariant::SCALAR;
 
-    if (result != CL_SUCCESS) {
-        char buffer[10240];
-        clGetProgramBuildInfo(m_program(), devices[0](), CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, NULL);
-        std::cout << buffer;
+    m_program = buildProgram(m_vectorWidth);
+
+    KernelConfig tuned;
+    if (OpenClAutotuner::load(OpenClAutotuner::DEFAULT_PATH, getDeviceKey(), tuned)) {
+        std::cout << "Using tuned kernel configuration from " << OpenClAutotuner::DEFAULT_PATH << "\n";
+        setKernelConfig(tuned);
     }
 }
 
-void OpenClRenderer::render(Tile * tile)
+std::string OpenClRenderer::getName() const
 {
-    tile->createTexture();
+    return "OpenCL (" + m_device.getInfo<CL_DEVICE_NAME>() + ")";
+}
 
+std::string OpenClRenderer::getDeviceKey() const
+{
+    return m_platform.getInfo<CL_PLATFORM_NAME>() + " / " +
+        m_device.getInfo<CL_DEVICE_NAME>() + " / " +
+        m_device.getInfo<CL_DRIVER_VERSION>();
+}
+
+const char* OpenClRenderer::getVariantName(KernelVariant variant)
+{
+    switch (variant) {
+    case KernelVariant::SCALAR: return "scalar";
+    case KernelVariant::VECTOR: return "vector";
+    case KernelVariant::PERSISTENT: return "persistent";
+    }
+    return "?";
+}
+
+OpenClRenderer::KernelConfig OpenClRenderer::getKernelConfig() const
+{
+    return { m_variant, m_vectorWidth, m_localWidth, m_localHeight };
+}
+
+void OpenClRenderer::setKernelConfig(const KernelConfig& config)
+{
+    // The build may throw, and then leaves the configuration as it was
+    setVectorWidth(config.vectorWidth);
+    setKernelVariant(config.variant);
+    m_localWidth = config.localWidth;
+    m_localHeight = config.localHeight;
+}
+
+OpenClRenderer::KernelVariant OpenClRenderer::getKernelVariant() const
+{
+    return m_variant;
+}
+
+void OpenClRenderer::setKernelVariant(KernelVariant variant)
+{
+    m_variant = variant;
+}
+
+int OpenClRenderer::getVectorWidth() const
+{
+    return m_vectorWidth;
+}
+
+void OpenClRenderer::setVectorWidth(int width)
+{
+    int chosen = chooseVectorWidth(width);
+    if (chosen == m_vectorWidth) return;
+
+    // Only a program which built replaces the old one
+    m_program = buildProgram(chosen);
+    m_vectorWidth = chosen;
+}
+
+cl::Program OpenClRenderer::buildProgram(int vectorWidth) const
+{
     cl_int result;
 
+    cl::Program program(m_context, kernelSourceStr, false, &result);
+    myassert(result);
+
+    std::string options = "-D VECTOR_WIDTH=" + std::to_string(vectorWidth) +
+        " -D HISTOGRAM_BINS=" + std::to_string(TileCost::HISTOGRAM_BINS) +
+        " -D MAP_SIZE=" + std::to_string(TileCost::MAP_SIZE);
+
+    try {
+        program.build({ m_device }, options.c_str());
+    }
+    catch (const cl::Error&) {
+        std::cout << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device);
+        throw;
+    }
+
+    return program;
+}
+
+void OpenClRenderer::enqueueKernel(const Tile::Bounds& bounds, int size, const cl::Image& output, int layer, const cl::Buffer& statistics, cl::Event* kernelEvent)
+{
+    cl_int result;
+
+    // Width 1 has no vector kernel
+    KernelVariant variant = m_variant;
+    if (variant == KernelVariant::VECTOR && m_vectorWidth == 1) {
+        variant = KernelVariant::SCALAR;
+    }
+
+    const char* kernelName = "mandelbrotKernel";
+    if (variant == KernelVariant::VECTOR) kernelName = "mandelbrotVectorKernel";
+    if (variant == KernelVariant::PERSISTENT) kernelName = "mandelbrotPersistentKernel";
+
     // Create the kernel
-    cl::Kernel mandelbrotKernel(m_program, "mandelbrotKernel", &result);
+    cl::Kernel mandelbrotKernel(m_program, kernelName, &result);
     myassert(result);
 
     cl::Buffer boundsBuffer(m_context,
         CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
         sizeof(Tile::Bounds),
-        (void*)(&(tile->getBounds())),
+        (void*)&bounds,
         &result
     );
 
     result = mandelbrotKernel.setArg(0, boundsBuffer);
+    myassert(result);
 
-    cl::ImageGL textureAsClMem(m_context,
-        CL_MEM_WRITE_ONLY,
-        GL_TEXTURE_2D,
-        0,
-        tile->getTexture(),
-        &result
-    );
+    result = mandelbrotKernel.setArg(1, output);
     myassert(result);
 
-    result = mandelbrotKernel.setArg(1, textureAsClMem);
+    result = mandelbrotKernel.setArg(2, layer);
+    myassert(result);
 
-    std::vector<cl::Memory> textureVector{ textureAsClMem };
-    result = m_queue.enqueueAcquireGLObjects(&textureVector);
+    result = mandelbrotKernel.setArg(3, statistics);
     myassert(result);
 
-    result = mandelbrotKernel.setArg(1, textureAsClMem);
+    if (variant == KernelVariant::PERSISTENT) {
+        int zero = 0;
+        cl::Buffer counterBuffer(m_context,
+            CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+            sizeof(int),
+            &zero,
+            &result
+        );
+        myassert(result);
+
+        result = mandelbrotKernel.setArg(4, counterBuffer);
+        myassert(result);
+
+        // Just enough work-groups to keep every compute unit busy
+        size_t local = std::min<size_t>(m_localWidth > 0 ? m_localWidth : PERSISTENT_GROUP_SIZE,
+            mandelbrotKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device));
+        size_t groups = m_device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * PERSISTENT_GROUPS_PER_UNIT;
+
+        result = m_queue.enqueueNDRangeKernel(mandelbrotKernel,
+            cl::NullRange,                          // offset
+            cl::NDRange(groups * local),            // global
+            cl::NDRange(local),                     // local
+            nullptr,
+            kernelEvent
+        );
+        myassert(result);
+        return;
+    }
+
+    int columns = variant == KernelVariant::VECTOR ? (size + m_vectorWidth - 1) / m_vectorWidth : size;
+
+    if (m_localWidth > 0) {
+        result = m_queue.enqueueNDRangeKernel(mandelbrotKernel,
+            cl::NullRange,                                                  // offset
+            cl::NDRange(roundUp(columns, m_localWidth), roundUp(size, m_localHeight)),  // global
+            cl::NDRange(m_localWidth, m_localHeight),                       // local
+            nullptr,
+            kernelEvent
+        );
+    }
+    else {
+        result = m_queue.enqueueNDRangeKernel(mandelbrotKernel,
+            cl::NullRange,                              // offset
+            cl::NDRange(columns, size),                 // global
+            cl::NullRange,                              // local left up to the driver
+            nullptr,
+            kernelEvent
+        );
+    }
     myassert(result);
+}
+
+void OpenClRenderer::render(Tile * tile)
+{
+    renderBatch({ tile });
+}
+
+void OpenClRenderer::renderBatch(const std::vector<Tile*>& tiles)
+{
+    if (tiles.empty()) return;
+
+    cl_int result;
+
+    // Every tile is a layer of the same texture array
+    GLuint texture = tiles[0]->getTexture();
+    if (texture != m_sharedTexture) {
+        m_sharedImage = cl::ImageGL(m_context,
+            CL_MEM_WRITE_ONLY,
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            texture,
+            &result
+        );
+        myassert(result);
 
+        m_sharedTexture = texture;
+    }
 
-    result = m_queue.enqueueNDRangeKernel(mandelbrotKernel,
-        cl::NullRange,                              // offset
-        cl::NDRange(tile->getTextureSize(), tile->getTextureSize())     // global
-    );  // local left up to the driver
+    // One acquire and one release for the whole batch
+    std::vector<cl::Memory> textureVector{ m_sharedImage };
+    result = m_queue.enqueueAcquireGLObjects(&textureVector);
     myassert(result);
 
+    std::vector<cl::Event> kernelEvents;
+    bool batched = m_variant == KernelVariant::SCALAR && tiles.size() > 1;
+
+    // Every tile's statistics, read back before the release, so they are
+    // in by the time completionEvent is
+    auto statistics = std::make_shared<std::vector<cl_uint>>(tiles.size() * STATS_SIZE);
+
+    if (batched) {
+        Trace::Span span("enqueueBatch");
+
+        cl::Buffer statisticsBuffer = createStatisticsBuffer((int)tiles.size());
+
+        cl::Event kernelEvent;
+        enqueueBatchKernel(tiles, statisticsBuffer, &kernelEvent);
+        kernelEvents.assign(tiles.size(), kernelEvent);
+
+        result = m_queue.enqueueReadBuffer(statisticsBuffer, CL_FALSE, 0, statistics->size() * sizeof(cl_uint), statistics->data());
+        myassert(result);
+    }
+    else {
+        // The other variants have no batch kernel, but still share the rest
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            Trace::Span span("enqueue", tiles[i]->getId(), tiles[i]->getGeneration());
+
+            cl::Buffer statisticsBuffer = createStatisticsBuffer(1);
+
+            cl::Event kernelEvent;
+            enqueueKernel(tiles[i]->getBounds(), tiles[i]->getTextureSize(), m_sharedImage, tiles[i]->getTextureLayer(), statisticsBuffer, &kernelEvent);
+            kernelEvents.push_back(kernelEvent);
+
+            result = m_queue.enqueueReadBuffer(statisticsBuffer, CL_FALSE, 0, STATS_SIZE * sizeof(cl_uint), statistics->data() + i * STATS_SIZE);
+            myassert(result);
+        }
+    }
+
     cl::Event completionEvent;
     result = m_queue.enqueueReleaseGLObjects(&textureVector, nullptr, &completionEvent);
     myassert(result);
 
-    tile->setRendering();
-    m_pendingRenders.emplace_back(tile, completionEvent);
+    // A shared kernel event is split evenly between its tiles
+    int sharing = batched ? (int)tiles.size() : 1;
+
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        tiles[i]->setRendering();
+        m_pendingRenders.push_back({ tiles[i], kernelEvents[i], completionEvent, sharing, statistics, i * STATS_SIZE });
+    }
 
     result = m_queue.flush();
     myassert(result);
 
 }
 
-void OpenClRenderer::checkPendingRenders()
+int OpenClRenderer::getMaxBatchSize() const
+{
+    return MAX_BATCH_SIZE;
+}
+
+void OpenClRenderer::enqueueBatchKernel(const std::vector<Tile*>& tiles, const cl::Buffer& statistics, cl::Event* kernelEvent)
+{
+    cl_int result;
+
+    int size = tiles[0]->getTextureSize();
+
+    std::vector<Tile::Bounds> boundsTable;
+    std::vector<cl_int> layerTable;
+    for (auto tile : tiles) {
+        assert(tile->getTextureSize() == size);
+        assert(tile->getTexture() == m_sharedTexture);
+        boundsTable.push_back(tile->getBounds());
+        layerTable.push_back(tile->getTextureLayer());
+    }
+
+    cl::Buffer boundsBuffer(m_context,
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(Tile::Bounds) * boundsTable.size(),
+        boundsTable.data(),
+        &result
+    );
+    myassert(result);
+
+    cl::Buffer layerBuffer(m_context,
+        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_int) * layerTable.size(),
+        layerTable.data(),
+        &result
+    );
+    myassert(result);
+
+    cl::Kernel batchKernel(m_program, "mandelbrotBatchKernel", &result);
+    myassert(result);
+
+    result = batchKernel.setArg(0, boundsBuffer);
+    myassert(result);
+
+    result = batchKernel.setArg(1, m_sharedImage);
+    myassert(result);
+
+    result = batchKernel.setArg(2, layerBuffer);
+    myassert(result);
+
+    result = batchKernel.setArg(3, statistics);
+    myassert(result);
+
+    // z picks the tile. Work-groups can't be left up to the driver here:
+    // the statistics are reduced per group, so a group may not span tiles.
+    int localWidth = m_localWidth;
+    int localHeight = m_localHeight;
+    if (localWidth <= 0) {
+        size_t maxGroupSize = batchKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+        localWidth = 16;
+        while ((size_t)localWidth * localWidth > maxGroupSize && localWidth > 1) {
+            localWidth /= 2;
+        }
+        localHeight = localWidth;
+    }
+
+    result = m_queue.enqueueNDRangeKernel(batchKernel,
+        cl::NullRange,                                                      // offset
+        cl::NDRange(roundUp(size, localWidth), roundUp(size, localHeight), tiles.size()),  // global
+        cl::NDRange(localWidth, localHeight, 1),                            // local
+        nullptr,
+        kernelEvent
+    );
+    myassert(result);
+}
+
+cl::Buffer OpenClRenderer::createStatisticsBuffer(int tiles)
+{
+    cl_int result;
+
+    // The minimum starts high, everything else at 0
+    std::vector<cl_uint> initial((size_t)tiles * STATS_SIZE, 0);
+    float highest = FLT_MAX;
+    for (int i = 0; i < tiles; ++i) {
+        memcpy(&initial[(size_t)i * STATS_SIZE + STATS_MIN], &highest, sizeof(highest));
+    }
+
+    cl::Buffer buffer(m_context,
+        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        initial.size() * sizeof(cl_uint),
+        initial.data(),
+        &result
+    );
+    myassert(result);
+
+    return buffer;
+}
+
+std::shared_ptr<TileCost> OpenClRenderer::readStatistics(const cl_uint* statistics, const Tile::Bounds& bounds, int size)
 {
+    auto cost = std::make_shared<TileCost>(size, size, bounds.maxIt);
+
+    // Cells split the pixels the way mapCell() and TileCost::addRows() do:
+    // pixel p is in cell p * MAP_SIZE / size
+    auto cellPixels = [size](int cell) {
+        return ((cell + 1) * size + TileCost::MAP_SIZE - 1) / TileCost::MAP_SIZE - (cell * size + TileCost::MAP_SIZE - 1) / TileCost::MAP_SIZE;
+    };
+
+    for (int row = 0; row < TileCost::MAP_SIZE; ++row) {
+        int rows = cellPixels(row);
+
+        for (int column = 0; column < TileCost::MAP_SIZE; ++column) {
+            int columns = cellPixels(column);
+
+            const cl_uint* words = statistics + STATS_MAP + 2 * (row * TileCost::MAP_SIZE + column);
+            double iterations = words[0] + words[1] * 4294967296.0;
+            double interior = statistics[STATS_MAP_INTERIOR + row * TileCost::MAP_SIZE + column];
+            cost->addCell(column, row, iterations, (double)rows * columns, interior);
+        }
+    }
+
+    for (int bin = 0; bin < TileCost::HISTOGRAM_BINS; ++bin) {
+        cost->addHistogram(bin, statistics[STATS_HISTOGRAM + bin]);
+    }
+
+    float minValue;
+    float maxValue;
+    memcpy(&minValue, &statistics[STATS_MIN], sizeof(minValue));
+    memcpy(&maxValue, &statistics[STATS_MAX], sizeof(maxValue));
+    if (statistics[STATS_INTERIOR] == (cl_uint)size * size) {
+        // Nothing escaped, so there is no range
+        minValue = FLT_MAX;
+        maxValue = -FLT_MAX;
+    }
+    cost->addRange(minValue, maxValue, statistics[STATS_INTERIOR]);
+
+    return cost;
+}
+
+double OpenClRenderer::renderToHost(const Tile::Bounds& bounds, int size, float* output, TileCost* cost)
+{
+    cl_int result;
+
+    // The kernels write to texture arrays, so this is an array of one
+    cl::Image2DArray image(m_context,
+        CL_MEM_WRITE_ONLY,
+        cl::ImageFormat(CL_R, CL_FLOAT),
+        1,
+        size,
+        size,
+        0,
+        0,
+        nullptr,
+        &result
+    );
+    myassert(result);
+
+    cl::Buffer statisticsBuffer = createStatisticsBuffer(1);
+
+    cl::Event kernelEvent;
+    enqueueKernel(bounds, size, image, 0, statisticsBuffer, &kernelEvent);
+
+    cl::size_t<3> origin;
+    origin[0] = 0;
+    origin[1] = 0;
+    origin[2] = 0;
+    cl::size_t<3> region;
+    region[0] = size;
+    region[1] = size;
+    region[2] = 1;
+
+    result = m_queue.enqueueReadImage(image, CL_TRUE, origin, region, 0, 0, output);
+    myassert(result);
+
+    if (cost != nullptr) {
+        std::vector<cl_uint> statistics(STATS_SIZE);
+        result = m_queue.enqueueReadBuffer(statisticsBuffer, CL_TRUE, 0, statistics.size() * sizeof(cl_uint), statistics.data());
+        myassert(result);
+
+        cost->merge(*readStatistics(statistics.data(), bounds, size));
+    }
+
+    cl_ulong start = kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong end = kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+    return (end - start) * 1e-9;
+}
+
+std::vector<RenderBackend::CompletedRender> OpenClRenderer::checkPendingRenders()
+{
+    std::vector<CompletedRender> completed;
+
     for (auto it = std::begin(m_pendingRenders); it != std::end(m_pendingRenders); /*Nothing*/) {
-        Tile* tile = it->first;
-        cl::Event event = it->second;
+        Tile* tile = it->tile;
+        cl::Event event = it->completionEvent;
 
         cl_int result;
         auto status = event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(&result);
         myassert(result);
 
         if (status == CL_COMPLETE) {
+            // Profiling counters are in nanoseconds
+            cl_ulong start = it->kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            cl_ulong end = it->kernelEvent.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+            auto cost = readStatistics(it->statistics->data() + it->statisticsOffset, tile->getBounds(), tile->getTextureSize());
+
             tile->setRendered();
+            tile->setCost(cost);
+            completed.push_back({ tile, (end - start) * 1e-9 / it->batchSize, cost->getTotalIterations() });
             it = m_pendingRenders.erase(it);
         }
         else {
             ++it;
         }
     }
+
+    return completed;
+}
+
+int OpenClRenderer::getPendingCount() const
+{
+    return (int)m_pendingRenders.size();
 }
@@ -3,23 +3,119 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
-#include <utility>
+#include <memory>
+#include <string>
+#include <vector>
 
-class Tile;
+#include "RenderBackend.h"
+#include "Tile.h"
+#include "TileCost.h"
 
-class OpenClRenderer {
+class OpenClRenderer : public RenderBackend {
 public:
-    OpenClRenderer();
+    enum class KernelVariant {
+        SCALAR,     // One pixel per work-item
+        VECTOR,     // A strip of getVectorWidth() pixels per work-item
+        PERSISTENT, // A fixed set of work-groups pulling pixel blocks from a queue
+    };
 
-    void render(Tile* tile);
+    // Everything the autotuner sweeps
+    struct KernelConfig {
+        KernelVariant variant;
+        int vectorWidth;
+        int localWidth;     // 0 leaves the work-group size up to the driver
+        int localHeight;    // Ignored by KernelVariant::PERSISTENT, which is 1D
+    };
 
-    void checkPendingRenders();
+    // Without GL sharing, tiles can only be rendered with renderToHost().
+    // That mode picks any device, so it also works on CPU runtimes like POCL.
+    explicit OpenClRenderer(bool shareGlContext = true);
+
+    std::string getName() const override;
+
+    // Identifies the platform, device and driver the tuning was done for
+    std::string getDeviceKey() const;
+
+    static const char* getVariantName(KernelVariant variant);
+
+    KernelConfig getKernelConfig() const;
+    void setKernelConfig(const KernelConfig& config);
+
+    KernelVariant getKernelVariant() const;
+    void setKernelVariant(KernelVariant variant);
+
+    // Pixels per work-item for KernelVariant::VECTOR
+    // Defaults to the device's preferred float vector width. Rebuilds the
+    // program; if that throws, the old width and program stay.
+    int getVectorWidth() const;
+    void setVectorWidth(int width);
+
+    void render(Tile* tile) override;
+
+    // All tiles share one acquire/release of their textures and one flush.
+    // With KernelVariant::SCALAR they are also rendered by a single kernel.
+    void renderBatch(const std::vector<Tile*>& tiles) override;
+
+    int getMaxBatchSize() const override;
+
+    std::vector<CompletedRender> checkPendingRenders() override;
+
+    int getPendingCount() const override;
+
+    // Renders into host memory (size * size floats) and waits for the result
+    // Returns the time the kernel took, in seconds
+    // The kernels' statistics go to cost, if given
+    double renderToHost(const Tile::Bounds& bounds, int size, float* output, TileCost* cost = nullptr);
 
 private:
+    struct PendingRender {
+        Tile* tile;
+        cl::Event kernelEvent;      // Profiled to measure the time spent on the tile
+        cl::Event completionEvent;
+        int batchSize;              // How many tiles kernelEvent rendered
+        // Read back from the kernels with the textures
+        std::shared_ptr<std::vector<cl_uint>> statistics;
+        size_t statisticsOffset;
+    };
+
+    // One split's worth of tiles
+    static const int MAX_BATCH_SIZE = 4;
+
+    // The per-tile statistics the kernels reduce, see STATS_* in the kernel source
+    static const int STATS_MIN = 0;
+    static const int STATS_MAX = 1;
+    static const int STATS_INTERIOR = 2;
+    static const int STATS_HISTOGRAM = 3;
+    static const int STATS_MAP = STATS_HISTOGRAM + TileCost::HISTOGRAM_BINS;
+    static const int STATS_MAP_INTERIOR = STATS_MAP + 2 * TileCost::MAP_SIZE * TileCost::MAP_SIZE;
+    static const int STATS_SIZE = STATS_MAP_INTERIOR + TileCost::MAP_SIZE * TileCost::MAP_SIZE;
+
+    cl::Device m_device;
     cl::Platform m_platform;
     cl::Context m_context;
     cl::CommandQueue m_queue;
     cl::Program m_program;
 
-    std::vector<std::pair<Tile*, cl::Event>> m_pendingRenders;
+    // Work-items per group, and groups per compute unit, for KernelVariant::PERSISTENT
+    static const int PERSISTENT_GROUP_SIZE = 64;
+    static const int PERSISTENT_GROUPS_PER_UNIT = 4;
+
+    KernelVariant m_variant;
+    int m_vectorWidth;
+    int m_localWidth;
+    int m_localHeight;
+
+    // The tiles' texture array, shared with GL
+    GLuint m_sharedTexture;
+    cl::ImageGL m_sharedImage;
+
+    cl::Program buildProgram(int vectorWidth) const;
+    void enqueueKernel(const Tile::Bounds& bounds, int size, const cl::Image& output, int layer, const cl::Buffer& statistics, cl::Event* kernelEvent);
+    void enqueueBatchKernel(const std::vector<Tile*>& tiles, const cl::Buffer& statistics, cl::Event* kernelEvent);
+
+    // Statistics for tiles tiles, cleared for the kernels to add to
+    cl::Buffer createStatisticsBuffer(int tiles);
+    static std::shared_ptr<TileCost> readStatistics(const cl_uint* statistics, const Tile::Bounds& bounds, int size);
+
+    std::vector<PendingRender> m_pendingRenders;
 };
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "Palette.h"
+
+#include <assert.h>
+#include <stdexcept>
+
+// Appends 256 colors going linearly from one color to the next
+static void addRamp(std::vector<unsigned char>& rgb, int fromR, int fromG, int fromB, int toR, int toG, int toB)
+{
+    for (int i = 0; i < 256; ++i) {
+        rgb.push_back((unsigned char)(fromR + (toR - fromR) * i / 255));
+        rgb.push_back((unsigned char)(fromG + (toG - fromG) * i / 255));
+        rgb.push_back((unsigned char)(fromB + (toB - fromB) * i / 255));
+    }
+}
+
+Palette::Palette(std::vector<unsigned char> rgb) :
+    m_rgb(std::move(rgb))
+{
+    assert(!m_rgb.empty() && m_rgb.size() % 3 == 0);
+}
+
+Palette Palette::rainbow()
+{
+    std::vector<unsigned char> rgb;
+
+    // Red to yellow
+    addRamp(rgb, 255, 0, 0, 255, 255, 0);
+    // Yellow to green
+    addRamp(rgb, 255, 255, 0, 0, 255, 0);
+    // Green to cyan
+    addRamp(rgb, 0, 255, 0, 0, 255, 255);
+    // Cyan to blue
+    addRamp(rgb, 0, 255, 255, 0, 0, 255);
+    // Blue to violet
+    addRamp(rgb, 0, 0, 255, 255, 0, 255);
+    // Violet to red
+    addRamp(rgb, 255, 0, 255, 255, 0, 0);
+
+    return Palette(std::move(rgb));
+}
+
+Palette Palette::grayscale()
+{
+    std::vector<unsigned char> rgb;
+
+    // Back to black, so the cycle has no seam
+    addRamp(rgb, 0, 0, 0, 255, 255, 255);
+    addRamp(rgb, 255, 255, 255, 0, 0, 0);
+
+    return Palette(std::move(rgb));
+}
+
+Palette Palette::fire()
+{
+    std::vector<unsigned char> rgb;
+
+    addRamp(rgb, 0, 0, 0, 255, 0, 0);
+    addRamp(rgb, 255, 0, 0, 255, 255, 0);
+    addRamp(rgb, 255, 255, 0, 255, 255, 255);
+    addRamp(rgb, 255, 255, 255, 0, 0, 0);
+
+    return Palette(std::move(rgb));
+}
+
+Palette Palette::fromName(const std::string& name)
+{
+    if (name == "rainbow") return rainbow();
+    if (name == "grayscale") return grayscale();
+    if (name == "fire") return fire();
+
+    throw std::runtime_error("Unknown palette: " + name);
+}
+
+std::vector<std::string> Palette::getNames()
+{
+    return { "rainbow", "grayscale", "fire" };
+}
+
+int Palette::getSize() const
+{
+    return (int)(m_rgb.size() / 3);
+}
+
+const unsigned char* Palette::getData() const
+{
+    return m_rgb.data();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// A cyclic color gradient, 8-bit RGB. Screen uploads it as the 1D color
+// texture and Colorizer samples it on the CPU, so both agree on the colors.
+class Palette {
+public:
+    explicit Palette(std::vector<unsigned char> rgb);
+
+    // Red, yellow, green, cyan, blue, violet and back to red
+    static Palette rainbow();
+    static Palette grayscale();
+    static Palette fire();
+
+    // Throws std::runtime_error for a name not in getNames()
+    static Palette fromName(const std::string& name);
+    static std::vector<std::string> getNames();
+
+    // Number of colors
+    int getSize() const;
+    // getSize() * 3 bytes
+    const unsigned char* getData() const;
+
+private:
+    std::vector<unsigned char> m_rgb;
+};
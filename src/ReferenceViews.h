@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Tile.h"
+
+#include <vector>
+
+// Fixed views used by the benchmarks, so results can be compared over time
+struct ReferenceView {
+    const char* name;
+    Tile::Bounds bounds;
+};
+
+inline std::vector<ReferenceView> getReferenceViews()
+{
+    return {
+        // The root tile from tutorial05.cpp
+        { "full-set",       { -2.5f, 1.5f, -2.f, 2.f, 1000.f } },
+        // The zoom center from tutorial05.cpp, mostly boundary
+        { "seahorse-valley", { -0.7486439f, -0.7386439f, -0.1368259f, -0.1268259f, 1000.f } },
+        // Almost entirely inside the main cardioid, so every pixel runs to maxIt
+        { "cardioid-interior", { -0.45f, 0.05f, -0.25f, 0.25f, 1000.f } },
+        // Thin filaments near the seahorse valley center, at the limit of float precision
+        { "deep-filament",  { -0.7438439f, -0.7434439f, -0.1320259f, -0.1316259f, 5000.f } },
+    };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class Tile;
+
+// Anything that can fill a Tile's texture with the fractal
+class RenderBackend {
+public:
+    struct CompletedRender {
+        Tile* tile;
+        double seconds;     // How long the backend was busy with this tile
+        double iterations;  // Iterations the kernel ran, negative if not counted
+    };
+
+    virtual ~RenderBackend() = default;
+
+    virtual std::string getName() const = 0;
+
+    // Starts rendering the tile in the background, into its texture layer
+    // EMPTY -> RENDERING
+    virtual void render(Tile* tile) = 0;
+
+    // Starts rendering several tiles at once. Backends which can share the
+    // launch overhead between tiles override this.
+    virtual void renderBatch(const std::vector<Tile*>& tiles)
+    {
+        for (auto tile : tiles) {
+            render(tile);
+        }
+    }
+
+    // Most tiles renderBatch() should be given at once
+    virtual int getMaxBatchSize() const
+    {
+        return 1;
+    }
+
+    // Returns the tiles which finished since the last call
+    // RENDERING -> ACTIVE
+    virtual std::vector<CompletedRender> checkPendingRenders() = 0;
+
+    // Number of tiles passed to render() which haven't completed yet
+    virtual int getPendingCount() const = 0;
+};
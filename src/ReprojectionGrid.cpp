@@ -0,0 +1,104 @@
+#include "ReprojectionGrid.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+// Footprint of cells nothing covers
+static const float MISSING = std::numeric_limits<float>::infinity();
+
+ReprojectionGrid::ReprojectionGrid() :
+    m_view{ 0.f, 0.f, 0.f, 0.f, 0.f },
+    m_pixelSize(0.f),
+    m_hasHistory(false),
+    m_footprints(SIZE * SIZE, MISSING),
+    m_marked(SIZE * SIZE, true),
+    m_markedCount(SIZE * SIZE)
+{
+}
+
+void ReprojectionGrid::update(const Tile::Bounds& view, int widthPx, const std::vector<Tile*>& tiles)
+{
+    float pixelSize = (view.right - view.left) / widthPx;
+    float cellWidth = (view.right - view.left) / SIZE;
+    float cellHeight = (view.bottom - view.top) / SIZE;
+
+    std::vector<float> footprints(SIZE * SIZE, MISSING);
+
+    float oldCellWidth = (m_view.right - m_view.left) / SIZE;
+    float oldCellHeight = (m_view.bottom - m_view.top) / SIZE;
+
+    for (int row = 0; row < SIZE; ++row) {
+        float y = view.top + (row + 0.5f) * cellHeight;
+
+        for (int column = 0; column < SIZE; ++column) {
+            float x = view.left + (column + 0.5f) * cellWidth;
+            float& footprint = footprints[row * SIZE + column];
+
+            // The same nearest sample the GPU takes from the last frame
+            if (m_hasHistory) {
+                int oldColumn = (int)floorf((x - m_view.left) / oldCellWidth);
+                int oldRow = (int)floorf((y - m_view.top) / oldCellHeight);
+                if (oldColumn >= 0 && oldColumn < SIZE && oldRow >= 0 && oldRow < SIZE) {
+                    footprint = std::max(m_footprints[oldRow * SIZE + oldColumn], m_pixelSize);
+                }
+            }
+
+            for (auto tile : tiles) {
+                if (tile->getSampleStride() == 0)
+                    continue;
+
+                auto bounds = tile->getBounds();
+                if (x < bounds.left || x >= bounds.right || y < bounds.top || y >= bounds.bottom)
+                    continue;
+
+                // Solid tiles are exact at any size
+                footprint = tile->isSolid() ? 0.f : std::min(footprint, (bounds.right - bounds.left) / tile->getTextureSize() * tile->getSampleStride());
+            }
+        }
+    }
+
+    m_markedCount = 0;
+    for (size_t i = 0; i < footprints.size(); ++i) {
+        m_marked[i] = !(footprints[i] <= MAX_FOOTPRINT_PIXELS * pixelSize);
+        m_markedCount += m_marked[i] ? 1 : 0;
+    }
+
+    m_footprints.swap(footprints);
+    m_view = view;
+    m_pixelSize = pixelSize;
+    m_hasHistory = true;
+}
+
+void ReprojectionGrid::reset()
+{
+    m_hasHistory = false;
+}
+
+bool ReprojectionGrid::needsRecompute(const Tile::Bounds& region) const
+{
+    if (!m_hasHistory || !inside(region, m_view))
+        return false;
+
+    float cellWidth = (m_view.right - m_view.left) / SIZE;
+    float cellHeight = (m_view.bottom - m_view.top) / SIZE;
+
+    int firstColumn = std::max(0, (int)floorf((region.left - m_view.left) / cellWidth));
+    int lastColumn = std::min(SIZE - 1, (int)floorf((region.right - m_view.left) / cellWidth));
+    int firstRow = std::max(0, (int)floorf((region.top - m_view.top) / cellHeight));
+    int lastRow = std::min(SIZE - 1, (int)floorf((region.bottom - m_view.top) / cellHeight));
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            if (m_marked[row * SIZE + column])
+                return true;
+        }
+    }
+
+    return false;
+}
+
+int ReprojectionGrid::getMarkedCount() const
+{
+    return m_markedCount;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Tile.h"
+
+#include <vector>
+
+// A coarse CPU copy of what Screen's reprojection mode shows, used to decide
+// which parts of the view need new tiles first.
+//
+// Every cell holds the footprint of the data shown at its center, in plane
+// units: the texel size of the finest rendered tile there, or the last
+// frame's value moved under the new view, whichever is finer. Reprojected
+// data can never be finer than the pixels of the frame it came from, so it
+// coarsens as the camera zooms in. Cells whose footprint grows past
+// MAX_FOOTPRINT_PIXELS screen pixels, or which nothing covers, are marked.
+class ReprojectionGrid {
+public:
+    // Cells across and down the view
+    static const int SIZE = 64;
+
+    ReprojectionGrid();
+
+    // Moves the last frame's cells under the new view and merges in the tiles
+    void update(const Tile::Bounds& view, int widthPx, const std::vector<Tile*>& tiles);
+
+    // Forgets the last frame, for when nothing reprojects it
+    void reset();
+
+    // True if any marked cell overlaps the region
+    bool needsRecompute(const Tile::Bounds& region) const;
+
+    int getMarkedCount() const;
+
+private:
+    // How far past a screen pixel the shown data may stretch
+    static constexpr float MAX_FOOTPRINT_PIXELS = 1.5f;
+
+    Tile::Bounds m_view;
+    float m_pixelSize;
+    bool m_hasHistory;
+    std::vector<float> m_footprints;
+    std::vector<bool> m_marked;
+    int m_markedCount;
+};
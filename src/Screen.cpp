@@ -1,9 +1,14 @@
 #include "Screen.h"
 
 // Include standard headers
+#include <algorithm>
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -17,29 +22,59 @@ using namespace glm;
 #include <common/texture.hpp>
 
 #include "Camera.h"
+#include "Palette.h"
 #include "Tile.h"
 #include "TileSplitter.h"
+#include "Trace.h"
 
 const std::string TRANSFORM_VERTEX_SHADER = R"(
 #version 330 core
 
-// Input vertex data, different for all executions of this shader.
-layout(location = 0) in vec3 vertexPosition_modelspace;
-layout(location = 1) in vec2 vertexUV;
+// Corner of the unit quad, the same for every tile
+layout(location = 0) in vec2 corner;
+
+// Per drawn tile: where its data is in tileInstances
+layout(location = 1) in int tileSlot;
+// Per slot, two texels: left, right, top, bottom, then depth, texture
+// layer, iteration limit, sample stride
+uniform samplerBuffer tileInstances;
 
 // Output data ; will be interpolated for each fragment.
 out vec2 UV;
+flat out float layer;
+// Size of the tile's texels in the plane
+flat out float footprint;
+// Values this high are inside the set, tiles have their own limits
+flat out float maxIt;
+// Texels between the samples a progressive render has filled in so far
+flat out float stride;
 
 // Values that stay constant for the whole mesh.
 uniform mat4 MVP;
+uniform float tileTextureSize;
 
 void main(){
 
+	vec4 tileBounds = texelFetch(tileInstances, tileSlot * 2);
+	vec4 tileData = texelFetch(tileInstances, tileSlot * 2 + 1);
+
+	vec2 position = vec2(
+		mix(tileBounds.x, tileBounds.y, corner.x),
+		mix(tileBounds.z, tileBounds.w, corner.y)
+	);
+
 	// Output position of the vertex, in clip space : MVP * position
-	gl_Position =  MVP * vec4(vertexPosition_modelspace,1);
+	gl_Position =  MVP * vec4(position, 0, 1);
+	// The camera flattens z, the tile's depth is used as is
+	gl_Position.z = tileData.x;
 	
-	// UV of the vertex. No special space for this one.
-	UV = vertexUV;
+	// The corner doubles as the UV
+	UV = corner;
+	layer = tileData.y;
+	// Solid tiles are exact at any size
+	stride = tileData.w;
+	footprint = layer < 0 ? 0 : (tileBounds.y - tileBounds.x) / tileTextureSize * stride;
+	maxIt = tileData.z;
 }
 )";
 
@@ -48,29 +83,78 @@ const std::string TEXTURE_FRAGMENT_SHADER = R"(
 
 // Interpolated values from the vertex shaders
 in vec2 UV;
+flat in float layer;
+flat in float maxIt;
+flat in float stride;
 
 uniform vec3 background;
+uniform float tileTextureSize;
 
 uniform float cutoff;
 uniform float colorPeriod;
 
+// Samples per pixel on edges, 1 for none
+uniform int aaSamples;
+// Largest difference in any channel from a neighbor which counts as an edge
+uniform float aaThreshold;
+
 // Ouput data
 out vec3 color;
 
 // Values that stay constant for the whole mesh.
-uniform sampler2D myTextureSampler;
+uniform sampler2DArray myTextureSampler;
 
 uniform sampler1D colorSampler;
 
+// The tile's value at uv, read without derivatives so it works in branches
+float valueAt(vec2 uv){
+	// Until a progressive render is done, its samples are packed into the
+	// top left corner, one per texel
+	uv = clamp(uv, 0.0, 1.0 - 0.5 / tileTextureSize);
+	vec2 sampleUV = (floor(uv * tileTextureSize / stride) + 0.5) / tileTextureSize;
+
+	// Solid tiles have no layer, all of them is inside the set
+	return layer < 0 ? maxIt : textureLod( myTextureSampler, vec3(sampleUV, layer), 0.0 ).r;
+}
+
+// Unfiltered, since the samples are averaged instead
+vec3 colorOf(float depth){
+	if (depth > cutoff || depth >= maxIt)
+		return background;
+	return textureLod( colorSampler, depth / colorPeriod, 0.0 ).rgb;
+}
+
 void main(){
 
-	float depth = texture( myTextureSampler, UV).r;
+	// One screen pixel in the tile, taken while control flow is uniform
+	vec2 pixelX = dFdx(UV);
+	vec2 pixelY = dFdy(UV);
 
-	if (depth > cutoff)
+	float depth = valueAt(UV);
+
+	if (depth > cutoff || depth >= maxIt)
 		color = background;
 	else
 		color = texture( colorSampler, depth / colorPeriod ).rgb;
 
+	// Edges get sub-samples spread over the pixel along the R2 sequence,
+	// smooth areas keep their single one. Solid tiles have no edges.
+	if (aaSamples > 1 && layer >= 0) {
+		vec3 center = colorOf(depth);
+		vec3 contrast = max(
+			max(abs(colorOf(valueAt(UV - pixelX)) - center), abs(colorOf(valueAt(UV + pixelX)) - center)),
+			max(abs(colorOf(valueAt(UV - pixelY)) - center), abs(colorOf(valueAt(UV + pixelY)) - center)));
+
+		if (max(contrast.r, max(contrast.g, contrast.b)) > aaThreshold) {
+			vec3 sum = color;
+			for (int i = 1; i < aaSamples; ++i) {
+				vec2 offset = fract(vec2(0.7548776662, 0.5698402910) * float(i)) - 0.5;
+				sum += colorOf(valueAt(UV + offset.x * pixelX + offset.y * pixelY));
+			}
+			color = sum / float(aaSamples);
+		}
+	}
+
 
 	// Output color = color of the texture at the specified UV
 //	color.r = texture( myTextureSampler, UV ).r;
@@ -79,22 +163,142 @@ void main(){
 }
 )";
 
+// Reprojection mode, first pass: the tiles into the iteration buffer
+const std::string TILE_ITERATIONS_FRAGMENT_SHADER = R"(
+#version 330 core
+
+in vec2 UV;
+flat in float layer;
+flat in float footprint;
+flat in float maxIt;
+flat in float stride;
+
+uniform sampler2DArray myTextureSampler;
+uniform float tileTextureSize;
+
+// Iterations, and the size of the texel they were rendered for
+out vec2 result;
+
+// Above any cutoff, so tiles with different limits agree on the interior
+const float INTERIOR = 1e30;
+
+void main(){
+	vec2 sampleUV = (floor(UV * tileTextureSize / stride) + 0.5) / tileTextureSize;
+	float depth = layer < 0 ? maxIt : texture( myTextureSampler, vec3(sampleUV, layer) ).r;
+	result = vec2(depth >= maxIt ? INTERIOR : depth, footprint);
+}
+)";
+
+// Covers the whole target, for the passes working on iteration buffers
+const std::string FULLSCREEN_VERTEX_SHADER = R"(
+#version 330 core
+
+layout(location = 0) in vec2 corner;
+
+out vec2 UV;
+
+void main(){
+	gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);
+	UV = corner;
+}
+)";
+
+// Second pass: per pixel, the finer of this frame's tiles and the last frame
+const std::string RESOLVE_FRAGMENT_SHADER = R"(
+#version 330 core
+
+in vec2 UV;
+
+uniform sampler2D tileSampler;
+uniform sampler2D historySampler;
+
+// Where this frame's UV lands in the last frame
+uniform vec2 reprojectionScale;
+uniform vec2 reprojectionOffset;
+// Size of the last frame's pixels in the plane
+uniform float previousPixelSize;
+
+out vec2 result;
+
+void main(){
+	result = texture( tileSampler, UV ).rg;
+
+	vec2 previousUV = UV * reprojectionScale + reprojectionOffset;
+	if (all(greaterThanEqual(previousUV, vec2(0))) && all(lessThan(previousUV, vec2(1)))) {
+		vec2 history = texture( historySampler, previousUV ).rg;
+
+		// Resampled data is never finer than the pixels it was taken from
+		history.g = max(history.g, previousPixelSize);
+
+		if (history.g < result.g)
+			result = history;
+	}
+}
+)";
+
+// Last pass: the resolved iterations to the screen, like TEXTURE_FRAGMENT_SHADER
+const std::string COLORIZE_FRAGMENT_SHADER = R"(
+#version 330 core
+
+in vec2 UV;
+
+uniform sampler2D resolvedSampler;
+
+uniform vec3 background;
+uniform float cutoff;
+uniform float colorPeriod;
+uniform float missingFootprint;
+
+uniform sampler1D colorSampler;
+
+out vec3 color;
+
+void main(){
+	vec2 resolved = texture( resolvedSampler, UV ).rg;
+
+	if (resolved.g >= missingFootprint || resolved.r > cutoff)
+		color = background;
+	else
+		color = texture( colorSampler, resolved.r / colorPeriod ).rgb;
+}
+)";
+
 
 
 Screen::Screen(const Camera& camera, const TileSplitter& tiles) :
     m_camera(camera),
-    m_tiles(tiles)
+    m_tiles(tiles),
+    m_antialiasing(true),
+    m_aaSamples(1),
+    m_aaView{ 0.f, 0.f, 0.f, 0.f, 0.f },
+    m_slotCapacity(0),
+    m_slotBuffer(0),
+    m_slotTexture(0),
+    m_drawListBuffer(0),
+    m_slotMapping(nullptr),
+    m_drawListMapping(nullptr),
+    m_region(0),
+    m_regionFences{},
+    m_regionDraws{},
+    m_drawCount(0),
+    m_finishedDraws(0),
+    m_frameUploadBytes(0),
+    m_totalUploadBytes(0),
+    m_reprojection(false),
+    m_tileProgramId(0),
+    m_resolveProgramId(0),
+    m_colorizeProgramId(0),
+    m_tileFramebuffer(0),
+    m_tileBuffer(0),
+    m_tileDepthBuffer(0),
+    m_historyFramebuffers{ 0, 0 },
+    m_historyBuffers{ 0, 0 },
+    m_historyIndex(0),
+    m_previousView{ 0.f, 0.f, 0.f, 0.f, 0.f }
 {
 
 
 
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        throw std::runtime_error("Failed to initialize GLEW");
-    }
-
     // Dark blue background
     setClearColor(0.0f, 0.0f, 0.0f);
 
@@ -114,14 +318,11 @@ Screen::Screen(const Camera& camera, const TileSplitter& tiles) :
     m_programId = LoadShaders(TRANSFORM_VERTEX_SHADER, TEXTURE_FRAGMENT_SHADER);
 
 
-    // Get a handle for our "MVP" uniform
-    m_matrixId = glGetUniformLocation(m_programId, "MVP");
-
-
-
     m_backgroundId = glGetUniformLocation(m_programId, "background");
     m_cutoffId = glGetUniformLocation(m_programId, "cutoff");
     m_colorPeriodId = glGetUniformLocation(m_programId, "colorPeriod");
+    m_aaSamplesId = glGetUniformLocation(m_programId, "aaSamples");
+    m_aaThresholdId = glGetUniformLocation(m_programId, "aaThreshold");
 
 
 
@@ -129,16 +330,49 @@ Screen::Screen(const Camera& camera, const TileSplitter& tiles) :
 
     m_colorTexture = createGradientTexture();
 
-    // Get a handle for our "myTextureSampler" uniform
-    m_textureId = glGetUniformLocation(m_programId, "myTextureSampler");
-
     m_colorTextureId = glGetUniformLocation(m_programId, "colorSampler");
 
-    glGenBuffers(1, &m_vertexBuffer);
-
-    // All Tiles will share the same UV coords
-    glGenBuffers(1, &m_uvBuffer);
-
+    // Every tile is an instance of the unit quad
+    static const GLfloat quadCorners[] = {
+        // Top left
+        0.f, 1.f,
+        // Bottom left
+        0.f, 0.f,
+        // Bottom right
+        1.f, 0.f,
+
+        // Top left
+        0.f, 1.f,
+        // Bottom right
+        1.f, 0.f,
+        // Top right
+        1.f, 1.f,
+    };
+
+    glGenBuffers(1, &m_quadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadCorners), quadCorners, GL_STATIC_DRAW);
+
+    // 1rst attribute buffer : quad corners
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(
+        0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
+        2,                  // size
+        GL_FLOAT,           // type
+        GL_FALSE,           // normalized?
+        0,                  // stride
+        (void*)0            // array buffer offset
+    );
+
+    // 2nd attribute buffer : the drawn tiles' slots, pointed at the draw
+    // list's region by drawTiles()
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &m_slotTexture);
+    createInstanceBuffers(INITIAL_SLOTS);
 
 
 }
@@ -146,166 +380,536 @@ Screen::Screen(const Camera& camera, const TileSplitter& tiles) :
 Screen::~Screen()
 {
     // Cleanup VBO and shader
-    glDeleteBuffers(1, &m_vertexBuffer);
-    glDeleteBuffers(1, &m_uvBuffer);
+    deleteInstanceBuffers();
+    glDeleteTextures(1, &m_slotTexture);
+    glDeleteBuffers(1, &m_quadBuffer);
     glDeleteProgram(m_programId);
+    if (m_tileFramebuffer != 0) {
+        glDeleteFramebuffers(1, &m_tileFramebuffer);
+        glDeleteFramebuffers(2, m_historyFramebuffers);
+        glDeleteTextures(1, &m_tileBuffer);
+        glDeleteTextures(2, m_historyBuffers);
+        glDeleteRenderbuffers(1, &m_tileDepthBuffer);
+        glDeleteProgram(m_tileProgramId);
+        glDeleteProgram(m_resolveProgramId);
+        glDeleteProgram(m_colorizeProgramId);
+    }
     glDeleteTextures(1, &m_colorTexture);
     glDeleteVertexArrays(1, &m_vertexArrayId);
 
 }
 
-void Screen::draw() const
+void Screen::draw()
+{
+    Trace::Span span("draw");
+
+    updateInstances();
+
+    // Sub-samples only once the view holds still and is done, doubling each
+    // frame so the cost comes in steps
+    Tile::Bounds view = m_camera.getBounds();
+    bool moved = view.left != m_aaView.left || view.right != m_aaView.right ||
+        view.top != m_aaView.top || view.bottom != m_aaView.bottom;
+    if (!m_antialiasing || moved || !m_tiles.isSharp()) {
+        m_aaSamples = 1;
+    }
+    else {
+        m_aaSamples = std::min(m_aaSamples * 2, MAX_AA_SAMPLES);
+    }
+    m_aaView = view;
+
+    if (m_reprojection) {
+        drawReprojected();
+    }
+    else {
+        // Clear the screen
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Use our shader
+        glUseProgram(m_programId);
+
+        // Background black
+        glUniform3f(m_backgroundId, 0.f, 0.f, 0.f);
+        glUniform1f(m_cutoffId, (float)m_camera.getCutoff());
+        glUniform1f(m_colorPeriodId, 32.f);
+        glUniform1i(m_aaSamplesId, m_aaSamples);
+        glUniform1f(m_aaThresholdId, AA_THRESHOLD);
+
+        // Now the color texture
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_1D, m_colorTexture);
+        // Set the colorSampler to use Texture Unit 1
+        glUniform1i(m_colorTextureId, 1);
+
+        drawTiles(m_programId);
+    }
+
+    // The next write to the region, and reusing the slots this draw read,
+    // must wait until the GPU is done with it
+    ++m_drawCount;
+    GLsync& fence = m_regionFences[m_region];
+    if (fence != nullptr) {
+        glDeleteSync(fence);
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_regionDraws[m_region] = m_drawCount;
+}
+
+void Screen::setReprojection(bool enabled)
 {
+    GLint target = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
 
-    // Clear the screen
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (enabled && m_tileFramebuffer == 0) {
+        createReprojectionTargets();
+    }
+
+    if (enabled && !m_reprojection) {
+        // Whatever the history holds is from before the mode was left
+        GLfloat missing[] = { 0.f, MISSING_FOOTPRINT, 0.f, 0.f };
+        for (int i = 0; i < 2; ++i) {
+            glBindFramebuffer(GL_FRAMEBUFFER, m_historyFramebuffers[i]);
+            glClearBufferfv(GL_COLOR, 0, missing);
+        }
+        m_previousView = m_camera.getBounds();
+    }
 
-    // Use our shader
-    glUseProgram(m_programId);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)target);
+    m_reprojection = enabled;
+}
+
+void Screen::setAntialiasing(bool enabled)
+{
+    m_antialiasing = enabled;
+}
+
+bool Screen::isSettled() const
+{
+    return !m_antialiasing || m_reprojection || m_aaSamples == MAX_AA_SAMPLES;
+}
+
+int Screen::getDrawnTileCount() const
+{
+    return (int)m_regionSlots[m_region].size();
+}
+
+size_t Screen::getFrameUploadBytes() const
+{
+    return m_frameUploadBytes;
+}
+
+unsigned long long Screen::getTotalUploadBytes() const
+{
+    return m_totalUploadBytes;
+}
+
+void Screen::drawTiles(GLuint programId)
+{
+    glUseProgram(programId);
 
     // Send our transformation to the currently bound shader, 
     // in the "MVP" uniform
     auto mvp = m_camera.getMvp();
-    glUniformMatrix4fv(m_matrixId, 1, GL_FALSE, &mvp[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(programId, "MVP"), 1, GL_FALSE, &mvp[0][0]);
+    glUniform1f(glGetUniformLocation(programId, "tileTextureSize"), (float)m_tiles.getTextures().getSize());
 
-    // Background black
-    glUniform3f(m_backgroundId, 0.f, 0.f, 0.f);
-    glUniform1f(m_cutoffId, (float)m_camera.getCutoff());
-    glUniform1f(m_colorPeriodId, 32.f);
+    // Bind the tile textures in Texture Unit 0
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_tiles.getTextures().getTexture());
+    // Set our "myTextureSampler" sampler to use Texture Unit 0
+    glUniform1i(glGetUniformLocation(programId, "myTextureSampler"), 0);
 
+    // The slots in Texture Unit 2
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, m_slotTexture);
+    glUniform1i(glGetUniformLocation(programId, "tileInstances"), 2);
 
-    for (auto tile : m_tiles.getTiles()) {
+    glBindVertexArray(m_vertexArrayId);
 
+    // The draw list is in the region written last
+    size_t regionOffset = (size_t)m_region * m_slotCapacity * sizeof(GLint);
+    glBindBuffer(GL_ARRAY_BUFFER, m_drawListBuffer);
+    glVertexAttribIPointer(1, 1, GL_INT, sizeof(GLint), (void*)regionOffset);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        // Bind our texture in Texture Unit 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tile->getTexture());
-        // Set our "myTextureSampler" sampler to use Texture Unit 0
-        glUniform1i(m_textureId, 0);
+    // Draw every tile at once
+    GLsizei instanceCount = (GLsizei)m_regionSlots[m_region].size();
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 2 * 3, instanceCount);
+}
 
-        // Now the color texture
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_1D, m_colorTexture);
-        // Set the colorSampler to use Texture Unit 1
-        glUniform1i(m_colorTextureId, 1);
+void Screen::drawReprojected()
+{
+    // Whatever the caller draws into, a window or HeadlessContext
+    GLint target = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+
+    // The tiles, with the footprint of their texels
+    glBindFramebuffer(GL_FRAMEBUFFER, m_tileFramebuffer);
+    GLfloat missing[] = { 0.f, MISSING_FOOTPRINT, 0.f, 0.f };
+    glClearBufferfv(GL_COLOR, 0, missing);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    drawTiles(m_tileProgramId);
+
+    // The rest of the passes cover every pixel once
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(m_vertexArrayId);
 
+    // Merge in the last frame
+    int previous = m_historyIndex;
+    m_historyIndex = 1 - m_historyIndex;
+
+    const auto view = m_camera.getBounds();
+    float previousWidth = m_previousView.right - m_previousView.left;
+    float previousHeight = m_previousView.bottom - m_previousView.top;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_historyFramebuffers[m_historyIndex]);
+    glUseProgram(m_resolveProgramId);
+    glUniform2f(glGetUniformLocation(m_resolveProgramId, "reprojectionScale"),
+        (view.right - view.left) / previousWidth,
+        (view.bottom - view.top) / previousHeight);
+    glUniform2f(glGetUniformLocation(m_resolveProgramId, "reprojectionOffset"),
+        (view.left - m_previousView.left) / previousWidth,
+        (view.top - m_previousView.top) / previousHeight);
+    glUniform1f(glGetUniformLocation(m_resolveProgramId, "previousPixelSize"), previousWidth / m_camera.getWidthPx());
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_tileBuffer);
+    glUniform1i(glGetUniformLocation(m_resolveProgramId, "tileSampler"), 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_historyBuffers[previous]);
+    glUniform1i(glGetUniformLocation(m_resolveProgramId, "historySampler"), 1);
+
+    glDrawArrays(GL_TRIANGLES, 0, 2 * 3);
+
+    // And color it for the screen
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)target);
+    glUseProgram(m_colorizeProgramId);
+    glUniform3f(glGetUniformLocation(m_colorizeProgramId, "background"), 0.f, 0.f, 0.f);
+    glUniform1f(glGetUniformLocation(m_colorizeProgramId, "cutoff"), (float)m_camera.getCutoff());
+    glUniform1f(glGetUniformLocation(m_colorizeProgramId, "colorPeriod"), 32.f);
+    glUniform1f(glGetUniformLocation(m_colorizeProgramId, "missingFootprint"), MISSING_FOOTPRINT);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_historyBuffers[m_historyIndex]);
+    glUniform1i(glGetUniformLocation(m_colorizeProgramId, "resolvedSampler"), 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, m_colorTexture);
+    glUniform1i(glGetUniformLocation(m_colorizeProgramId, "colorSampler"), 1);
+
+    glDrawArrays(GL_TRIANGLES, 0, 2 * 3);
 
+    glEnable(GL_DEPTH_TEST);
+    m_previousView = view;
+}
 
-        // 1rst attribute buffer : vertices
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+// One screen sized, two channel float texture, sampled without filtering
+static GLuint createIterationBuffer(int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
 
-        // Fill the vertex buffer
-        GLfloat g_vertex_buffer_data[18];
-        tile->getVertexData(g_vertex_buffer_data);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+void Screen::createReprojectionTargets()
+{
+    int width = m_camera.getWidthPx();
+    int height = m_camera.getHeightPx();
+
+    m_tileProgramId = LoadShaders(TRANSFORM_VERTEX_SHADER, TILE_ITERATIONS_FRAGMENT_SHADER);
+    m_resolveProgramId = LoadShaders(FULLSCREEN_VERTEX_SHADER, RESOLVE_FRAGMENT_SHADER);
+    m_colorizeProgramId = LoadShaders(FULLSCREEN_VERTEX_SHADER, COLORIZE_FRAGMENT_SHADER);
+
+    m_tileBuffer = createIterationBuffer(width, height);
+
+    glGenRenderbuffers(1, &m_tileDepthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_tileDepthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_tileFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_tileFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_tileBuffer, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_tileDepthBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    glGenFramebuffers(2, m_historyFramebuffers);
+    for (int i = 0; i < 2; ++i) {
+        m_historyBuffers[i] = createIterationBuffer(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_historyFramebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_historyBuffers[i], 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
 
-        glVertexAttribPointer(
-            0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-            3,                  // size
-            GL_FLOAT,           // type
-            GL_FALSE,           // normalized?
-            0,                  // stride
-            (void*)0            // array buffer offset
-        );
+    if (!complete) {
+        throw std::runtime_error("Iteration buffers can't be rendered to");
+    }
+}
 
+void Screen::updateInstances()
+{
+    Trace::Span span("updateInstances");
 
+    m_frameUploadBytes = 0;
+    collectSlots();
 
-        // 2nd attribute buffer : UVs
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, m_uvBuffer);
+    const auto viewBounds = m_camera.getBounds();
 
+    // Tiles keep their slot while their data stays the same. Whatever is
+    // left in m_slots afterwards belongs to tiles which went or changed.
+    std::unordered_map<long long, Slot> slots;
+    std::vector<std::pair<const Tile*, int>> visible;
+    for (auto tile : m_tiles.getTiles()) {
+        // The layer holds nothing useful until the tile has been rendered,
+        // or a progressive render has shown a pass
+        if (tile->getSampleStride() == 0)
+            continue;
+
+        Slot slot;
+        tile->getInstanceData(slot.data);
+
+        auto found = m_slots.find(tile->getId());
+        if (found != m_slots.end() && memcmp(found->second.data, slot.data, sizeof(slot.data)) == 0) {
+            slot.index = found->second.index;
+            m_slots.erase(found);
+        }
+        else {
+            slot.index = allocateSlot();
+            writeSlot(slot.index, slot.data);
+        }
+        slots.emplace(tile->getId(), slot);
+
+        // Only tiles which can contribute a pixel are drawn
+        if (!inside(tile->getBounds(), viewBounds))
+            continue;
+
+        if (tile->isCoveredByChildren())
+            continue;
+
+        visible.emplace_back(tile, slot.index);
+    }
 
-        // Fill the UV buffer
-        GLfloat g_uv_buffer_data[12];
-        tile->getUvData(g_uv_buffer_data);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(g_uv_buffer_data), g_uv_buffer_data, GL_STATIC_DRAW);
+    // The draws so far may still read them
+    for (const auto& gone : m_slots) {
+        m_retiredSlots.emplace_back(gone.second.index, m_drawCount);
+    }
+    m_slots.swap(slots);
 
-        glVertexAttribPointer(
-            1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
-            2,                                // size : U+V => 2
-            GL_FLOAT,                         // type
-            GL_FALSE,                         // normalized?
-            0,                                // stride
-            (void*)0                          // array buffer offset
-        );
+    // Front to back: deeper tiles are in front, and drawing them first lets
+    // early-z reject the parts of their parents they cover
+    std::stable_sort(visible.begin(), visible.end(), [](const std::pair<const Tile*, int>& a, const std::pair<const Tile*, int>& b) {
+        return a.first->getGeneration() > b.first->getGeneration();
+    });
 
-        // Draw the triangle !
-        glDrawArrays(GL_TRIANGLES, 0, 2 * 3); // 12*3 indices starting at 0 -> 12 triangles
+    std::vector<GLint> drawList;
+    for (const auto& entry : visible) {
+        drawList.push_back(entry.second);
     }
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
+    // Nothing more is written on frames where no tile came, went or moved in
+    // the order
+    if (drawList == m_regionSlots[m_region]) return;
+
+    if (m_drawListMapping != nullptr) {
+        // The last frames' draws may still be reading their regions. The
+        // next one was read three frames ago, so its fence is usually done.
+        m_region = (m_region + 1) % MAPPED_REGIONS;
+        GLsync& fence = m_regionFences[m_region];
+        if (fence != nullptr) {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fence);
+            fence = nullptr;
+            m_finishedDraws = std::max(m_finishedDraws, m_regionDraws[m_region]);
+        }
+    }
+    auto& uploaded = m_regionSlots[m_region];
+
+    // Only the span between the first and last entry which differ from what
+    // the region holds is written
+    size_t first = 0;
+    size_t common = std::min(drawList.size(), uploaded.size());
+    while (first < common && drawList[first] == uploaded[first]) {
+        ++first;
+    }
 
+    size_t end = drawList.size();
+    if (drawList.size() == uploaded.size()) {
+        while (end > first && drawList[end - 1] == uploaded[end - 1]) {
+            --end;
+        }
+    }
 
+    size_t bytes = (end - first) * sizeof(GLint);
+    m_frameUploadBytes += bytes;
+    m_totalUploadBytes += bytes;
+
+    if (first < end) {
+        if (m_drawListMapping != nullptr) {
+            GLint* region = m_drawListMapping + (size_t)m_region * m_slotCapacity;
+            memcpy(region + first, &drawList[first], bytes);
+        }
+        else {
+            glBindBuffer(GL_ARRAY_BUFFER, m_drawListBuffer);
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(GLint), bytes, &drawList[first]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
 
+    uploaded.swap(drawList);
 }
 
+void Screen::createInstanceBuffers(int capacity)
+{
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if ((long long)capacity * (INSTANCE_FLOATS / 4) > maxTexels) {
+        throw std::runtime_error("Too many tiles for the instance buffer");
+    }
+
+    deleteInstanceBuffers();
 
+    // No draw reads the new buffers yet, so retired slots are free right away
+    for (const auto& slot : m_retiredSlots) {
+        m_freeSlots.push_back(slot.first);
+    }
+    m_retiredSlots.clear();
+    for (int index = capacity - 1; index >= m_slotCapacity; --index) {
+        m_freeSlots.push_back(index);
+    }
 
+    m_slotCapacity = capacity;
+    m_slotData.resize((size_t)capacity * INSTANCE_FLOATS);
 
+    GLsizeiptr slotBytes = (GLsizeiptr)m_slotData.size() * sizeof(GLfloat);
+    GLsizeiptr drawListBytes = (GLsizeiptr)capacity * sizeof(GLint);
 
-GLuint Screen::createGradientTexture()
-{
-    int width = 256 * 6;
+    glGenBuffers(1, &m_slotBuffer);
+    glGenBuffers(1, &m_drawListBuffer);
+
+    if (GLEW_ARB_buffer_storage) {
+        // Mapped once for the lifetime of the buffers, writes go straight to them
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
-    auto buffer = new unsigned char[width * 3];
+        glBindBuffer(GL_ARRAY_BUFFER, m_slotBuffer);
+        glBufferStorage(GL_ARRAY_BUFFER, slotBytes, m_slotData.data(), flags);
+        m_slotMapping = (GLfloat*)glMapBufferRange(GL_ARRAY_BUFFER, 0, slotBytes, flags);
 
+        glBindBuffer(GL_ARRAY_BUFFER, m_drawListBuffer);
+        glBufferStorage(GL_ARRAY_BUFFER, drawListBytes * MAPPED_REGIONS, nullptr, flags);
+        m_drawListMapping = (GLint*)glMapBufferRange(GL_ARRAY_BUFFER, 0, drawListBytes * MAPPED_REGIONS, flags);
 
-    // Red to yellow
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((0 * 256) + i) * 3;
+        if (m_slotMapping == nullptr || m_drawListMapping == nullptr) {
+            throw std::runtime_error("Failed to map the instance buffers");
+        }
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, m_slotBuffer);
+        glBufferData(GL_ARRAY_BUFFER, slotBytes, m_slotData.data(), GL_DYNAMIC_DRAW);
 
-        pixel[0] = 255;
-        pixel[1] = i;
-        pixel[2] = 0;
+        glBindBuffer(GL_ARRAY_BUFFER, m_drawListBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawListBytes, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, m_slotTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_slotBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void Screen::deleteInstanceBuffers()
+{
+    // Draws still in flight keep the old buffers alive, GL deletes them after
+    for (int region = 0; region < MAPPED_REGIONS; ++region) {
+        if (m_regionFences[region] != nullptr) {
+            glDeleteSync(m_regionFences[region]);
+            m_regionFences[region] = nullptr;
+        }
+        m_regionSlots[region].clear();
     }
-    // Yellow to green
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((1 * 256) + i) * 3;
-
-        pixel[0] = 255 - i;
-        pixel[1] = 255;
-        pixel[2] = 0;
+    m_region = 0;
+
+    if (m_slotMapping != nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_slotBuffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, m_drawListBuffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        m_slotMapping = nullptr;
+        m_drawListMapping = nullptr;
     }
-    // Green to cyan
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((2 * 256) + i) * 3;
-
-        pixel[0] = 0;
-        pixel[1] = 255;
-        pixel[2] = i;
+    if (m_slotBuffer != 0) {
+        glDeleteBuffers(1, &m_slotBuffer);
+        glDeleteBuffers(1, &m_drawListBuffer);
+        m_slotBuffer = 0;
+        m_drawListBuffer = 0;
     }
-    // Cyan to blue
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((3 * 256) + i) * 3;
-
-        pixel[0] = 0;
-        pixel[1] = 255 - i;
-        pixel[2] = 255;
+}
+
+int Screen::allocateSlot()
+{
+    if (m_freeSlots.empty()) {
+        createInstanceBuffers(m_slotCapacity * 2);
     }
-    // Blue to violet
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((4 * 256) + i) * 3;
-
-        pixel[0] = i;
-        pixel[1] = 0;
-        pixel[2] = 255;
+
+    int index = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return index;
+}
+
+void Screen::writeSlot(int index, const GLfloat* data)
+{
+    size_t offset = (size_t)index * INSTANCE_FLOATS;
+    size_t bytes = INSTANCE_FLOATS * sizeof(GLfloat);
+    memcpy(&m_slotData[offset], data, bytes);
+
+    // Free slots are read by no draw in flight, so nothing waits
+    if (m_slotMapping != nullptr) {
+        memcpy(m_slotMapping + offset, data, bytes);
+    }
+    else {
+        glBindBuffer(GL_ARRAY_BUFFER, m_slotBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(GLfloat), bytes, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    m_frameUploadBytes += bytes;
+    m_totalUploadBytes += bytes;
+}
+
+void Screen::collectSlots()
+{
+    if (m_retiredSlots.empty()) return;
+
+    // Without waiting, only fences which are already done count
+    for (int region = 0; region < MAPPED_REGIONS; ++region) {
+        GLsync fence = m_regionFences[region];
+        if (fence != nullptr && glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+            m_finishedDraws = std::max(m_finishedDraws, m_regionDraws[region]);
+        }
     }
-    // Violet to red
-    for (int i = 0; i < 256; ++i)
-    {
-        auto pixel = buffer + ((5 * 256) + i) * 3;
-
-        pixel[0] = 255;
-        pixel[1] = 0;
-        pixel[2] = 255 - i;
+
+    auto done = std::stable_partition(m_retiredSlots.begin(), m_retiredSlots.end(), [this](const std::pair<int, unsigned long long>& slot) {
+        return slot.second > m_finishedDraws;
+    });
+    for (auto it = done; it != m_retiredSlots.end(); ++it) {
+        m_freeSlots.push_back(it->first);
     }
+    m_retiredSlots.erase(done, m_retiredSlots.end());
+}
+
+
+
+
+GLuint Screen::createGradientTexture()
+{
+    // Shared with Colorizer, so offline renders get the same colors
+    Palette palette = Palette::rainbow();
 
     GLuint textureID;
     glGenTextures(1, &textureID);
@@ -313,7 +917,7 @@ GLuint Screen::createGradientTexture()
     glBindTexture(GL_TEXTURE_1D, textureID);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // I don't think this is necessary
 
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, width, 0, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, palette.getSize(), 0, GL_RGB, GL_UNSIGNED_BYTE, palette.getData());
 
     // Do I need filtering?
 
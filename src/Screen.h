@@ -1,15 +1,21 @@
 #pragma once
 
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct GLFWwindow;
 typedef unsigned int GLuint;
+typedef float GLfloat;
+typedef int GLint;
+typedef struct __GLsync *GLsync;
 
 // Include GLM
 #include <glm/glm.hpp>
 
+#include "Tile.h"
+
 class Camera;
-class Tile;
 class TileSplitter;
 
 class Screen 
@@ -18,28 +24,144 @@ public:
     Screen(const Camera& camera, const TileSplitter& tiles);
     virtual ~Screen();
 
-    void draw() const;
+    void draw();
+
+    // In reprojection mode the tiles are drawn into an iteration buffer
+    // first. The last frame's buffer, moved under the new camera, fills in
+    // wherever it is finer than the tiles or there are none, so a zoom shows
+    // sharp pixels long before the new tiles are done.
+    void setReprojection(bool enabled);
+
+    // Supersamples the pixels on edges once the view is still and sharp,
+    // with more samples each frame it stays that way. Not in reprojection
+    // mode. On by default.
+    void setAntialiasing(bool enabled);
+
+    // True once draw() shows all it will of a still, sharp view: with
+    // anti-aliasing at its most samples, if that is on
+    bool isSettled() const;
+
+    // Tiles drawn by the last draw(), after culling
+    int getDrawnTileCount() const;
+
+    // Bytes written to the instance buffers by the last draw(), and overall
+    size_t getFrameUploadBytes() const;
+    unsigned long long getTotalUploadBytes() const;
 
 private:
+    // Floats per slot, see Tile::getInstanceData()
+    static const int INSTANCE_FLOATS = 8;
+    // The persistently mapped draw list holds this many copies. A frame
+    // which changes it writes the copy the GPU read longest ago, so it
+    // rarely has to wait for it.
+    static const int MAPPED_REGIONS = 3;
+    // Slots to start with, doubled whenever they run out
+    static const int INITIAL_SLOTS = 256;
+
+    // Footprint of iteration buffer pixels no data reached, see the shaders
+    static constexpr float MISSING_FOOTPRINT = 1e30f;
+
+    // Samples per edge pixel at most, and the color difference, 0 to 1 in
+    // any channel, which makes an edge
+    static const int MAX_AA_SAMPLES = 16;
+    static constexpr float AA_THRESHOLD = 0.1f;
+
     const Camera& m_camera;
     const TileSplitter& m_tiles;
 
     GLuint m_vertexArrayId;
     GLuint m_programId;
-    GLuint m_matrixId;
     GLuint m_backgroundId;
     GLuint m_cutoffId;
     GLuint m_colorPeriodId;
-    GLuint m_textureId;
     GLuint m_colorTextureId;
+    GLuint m_aaSamplesId;
+    GLuint m_aaThresholdId;
+
+    bool m_antialiasing;
+    // Samples per edge pixel this frame, and the view they were for
+    int m_aaSamples;
+    Tile::Bounds m_aaView;
+
+    GLuint m_quadBuffer;
+
+    // Every tile with something to show has a slot holding its instance
+    // data for as long as that stays the same, in view or not. Only tiles
+    // which come, go or change are written. Shaders read the slots through
+    // m_slotTexture.
+    struct Slot {
+        int index;
+        GLfloat data[INSTANCE_FLOATS];
+    };
+    std::unordered_map<long long, Slot> m_slots;    // By Tile::getId()
+    int m_slotCapacity;
+    GLuint m_slotBuffer;
+    GLuint m_slotTexture;
+    // Everything the slot buffer holds, to fill it again once it has grown
+    std::vector<GLfloat> m_slotData;
+    std::vector<int> m_freeSlots;
+    // Slots given up, with the last draw which may still read them. They
+    // are free again once the GPU is done with it.
+    std::vector<std::pair<int, unsigned long long>> m_retiredSlots;
 
+    // The slots each frame draws, culled and ordered, one int per tile
+    GLuint m_drawListBuffer;
 
-    GLuint m_vertexBuffer;
-    GLuint m_uvBuffer;
+    // Persistently mapped buffers, null without ARB_buffer_storage
+    GLfloat* m_slotMapping;
+    GLint* m_drawListMapping;
+
+    // The region of the draw list draws read from, always 0 without the
+    // mapping. Per region, signalled once the GPU is done with the last draw
+    // from it, and which draw that was.
+    int m_region;
+    GLsync m_regionFences[MAPPED_REGIONS];
+    unsigned long long m_regionDraws[MAPPED_REGIONS];
+    // What each region of the draw list currently holds
+    std::vector<GLint> m_regionSlots[MAPPED_REGIONS];
+
+    // Draws issued, and how many of those the GPU is known to have finished
+    unsigned long long m_drawCount;
+    unsigned long long m_finishedDraws;
+    size_t m_frameUploadBytes;
+    unsigned long long m_totalUploadBytes;
 
 
     GLuint m_colorTexture;
 
+    // Reprojection mode: the programs for drawing tiles into the iteration
+    // buffer, merging in the last frame, and coloring the result
+    bool m_reprojection;
+    GLuint m_tileProgramId;
+    GLuint m_resolveProgramId;
+    GLuint m_colorizeProgramId;
+
+    // Iterations and footprint of the tiles drawn this frame
+    GLuint m_tileFramebuffer;
+    GLuint m_tileBuffer;
+    GLuint m_tileDepthBuffer;
+    // The resolved frame and the one before it, written in turns
+    GLuint m_historyFramebuffers[2];
+    GLuint m_historyBuffers[2];
+    int m_historyIndex;
+    Tile::Bounds m_previousView;
+
+    // Gives new and changed tiles slots, then culls and orders the tiles
+    // into the draw list
+    void updateInstances();
+    // (Re)creates the slot and draw list buffers with room for capacity
+    // tiles, filled with the slots' current data
+    void createInstanceBuffers(int capacity);
+    void deleteInstanceBuffers();
+    // Grows the buffers if every slot is taken
+    int allocateSlot();
+    void writeSlot(int index, const GLfloat* data);
+    // Frees the retired slots the GPU is done with
+    void collectSlots();
+    // Draws the instance buffer with a program using TRANSFORM_VERTEX_SHADER
+    void drawTiles(GLuint programId);
+    void drawReprojected();
+    void createReprojectionTargets();
     GLuint createGradientTexture();
     void setClearColor(float red, float green, float blue, float alpha = 0.0f);
 };
\ No newline at end of file
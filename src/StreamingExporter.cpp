@@ -0,0 +1,217 @@
+#include "StreamingExporter.h"
+
+#include "CpuKernel.h"
+#include "ImageWriter.h"
+#include "Palette.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+StreamingExporter::StreamingExporter(const Tile::Bounds& bounds, int width, int height, int bandRows) :
+    m_bounds(bounds),
+    m_width(width),
+    m_height(height),
+    m_bandRows(std::min(bandRows, height)),
+    m_maxSamples(1),
+    m_sampleBudget(0.0),
+    m_antialiasing{ 0, 0 }
+{
+    assert(width > 0 && height > 0 && bandRows > 0);
+}
+
+void StreamingExporter::setAntialiasing(int maxSamples, double budget)
+{
+    assert(maxSamples >= 1 && budget >= 0.0);
+
+    m_maxSamples = maxSamples;
+    m_sampleBudget = budget;
+}
+
+void StreamingExporter::exportImage(const std::string& path, const Colorizer& colorizer)
+{
+    ImageWriter writer(path, ImageWriter::formatForPath(path), m_width, m_height);
+
+    // Only touched by the writer thread
+    std::vector<unsigned char> rgb((size_t)m_width * m_bandRows * 3);
+    AdaptiveSampler sampler(m_bounds, m_width, m_height, colorizer, m_maxSamples, m_sampleBudget);
+
+    run([&](const Band& band) {
+        if (m_maxSamples > 1) {
+            sampler.resolveRows(band.depth, band.firstRow, band.rows, rgb.data());
+        }
+        else {
+            colorizer.colorize(band.depth, (size_t)m_width * band.rows, rgb.data());
+        }
+        writer.writeRows(rgb.data(), band.rows);
+    });
+
+    writer.close();
+
+    m_antialiasing = sampler.getStatistics();
+}
+
+AdaptiveSampler::Statistics StreamingExporter::getAntialiasingStatistics() const
+{
+    return m_antialiasing;
+}
+
+void StreamingExporter::exportCostMap(const std::string& path, TileCost& cost)
+{
+    ImageWriter writer(path, ImageWriter::formatForPath(path), m_width, m_height);
+
+    // The fire palette up to white, before it cycles back to black
+    Palette palette = Palette::fire();
+    int colors = palette.getSize() * 3 / 4;
+    double scale = (colors - 1) / log2(std::max(m_bounds.maxIt, 2.f));
+
+    std::vector<unsigned char> rgb((size_t)m_width * m_bandRows * 3);
+
+    run([&](const Band& band) {
+        cost.addRows(band.depth, band.firstRow, band.rows);
+
+        size_t count = (size_t)m_width * band.rows;
+        for (size_t i = 0; i < count; ++i) {
+            double iterations = CpuKernel::getIterations(band.depth[i], m_bounds.maxIt);
+            int color = std::min(std::max((int)(log2(iterations) * scale), 0), colors - 1);
+            const unsigned char* source = palette.getData() + color * 3;
+            rgb[i * 3 + 0] = source[0];
+            rgb[i * 3 + 1] = source[1];
+            rgb[i * 3 + 2] = source[2];
+        }
+
+        writer.writeRows(rgb.data(), band.rows);
+    });
+
+    writer.close();
+}
+
+void StreamingExporter::exportRaw(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    try {
+        run([&](const Band& band) {
+            size_t count = (size_t)m_width * band.rows;
+            if (fwrite(band.depth, sizeof(float), count, file) != count) {
+                throw std::runtime_error("Failed to write " + path);
+            }
+        });
+    }
+    catch (...) {
+        fclose(file);
+        throw;
+    }
+
+    if (fclose(file) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+size_t StreamingExporter::getPeakBytes(bool colorized) const
+{
+    size_t bandPixels = (size_t)m_width * m_bandRows;
+
+    size_t bytes = (BANDS_IN_FLIGHT + 1) * bandPixels * sizeof(float);
+    if (colorized) {
+        bytes += bandPixels * 3;
+    }
+    return bytes;
+}
+
+template <typename WriteBand>
+void StreamingExporter::run(WriteBand writeBand)
+{
+    const size_t bandFloats = (size_t)m_width * m_bandRows;
+
+    // One band rendering, the others waiting for or being written
+    std::vector<std::unique_ptr<float[]>> storage;
+    std::deque<float*> freeBuffers;
+    for (int i = 0; i < BANDS_IN_FLIGHT + 1; ++i) {
+        storage.emplace_back(new float[bandFloats]);
+        freeBuffers.push_back(storage.back().get());
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Band> renderedBands;
+    bool renderingDone = false;
+    std::exception_ptr writeError;
+
+    std::thread writer([&]() {
+        while (true) {
+            Band band;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return !renderedBands.empty() || renderingDone; });
+
+                if (renderedBands.empty()) return;
+
+                band = renderedBands.front();
+                renderedBands.pop_front();
+            }
+
+            try {
+                writeBand(band);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                writeError = std::current_exception();
+                changed.notify_all();
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeBuffers.push_back(band.depth);
+            }
+            changed.notify_all();
+        }
+    });
+
+    for (int firstRow = 0; firstRow < m_height; firstRow += m_bandRows) {
+        float* depth;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !freeBuffers.empty() || writeError; });
+
+            if (writeError) break;
+
+            depth = freeBuffers.front();
+            freeBuffers.pop_front();
+        }
+
+        int rows = std::min(m_bandRows, m_height - firstRow);
+        CpuKernel::renderRows(m_bounds, m_width, m_height, firstRow, rows, depth);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            renderedBands.push_back({ firstRow, rows, depth });
+        }
+        changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        renderingDone = true;
+    }
+    changed.notify_all();
+
+    writer.join();
+
+    if (writeError) {
+        std::rethrow_exception(writeError);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "AdaptiveSampler.h"
+#include "Colorizer.h"
+#include "Tile.h"
+#include "TileCost.h"
+
+#include <string>
+
+// Renders an image of any size in bands of rows, top to bottom, and streams
+// each band to disk as soon as it's done. Only a couple of bands exist at a
+// time, so memory depends on the width and band height, not the image size.
+// The next band renders on every core while a writer thread colorizes and
+// writes the previous one.
+class StreamingExporter {
+public:
+    StreamingExporter(const Tile::Bounds& bounds, int width, int height, int bandRows);
+
+    // Makes exportImage() supersample edges with AdaptiveSampler, up to
+    // maxSamples per pixel and budget extra ones per pixel on average.
+    // Off by default, and at maxSamples 1.
+    void setAntialiasing(int maxSamples, double budget);
+
+    // Colorizes and writes a PNG or PPM, picked from the extension
+    void exportImage(const std::string& path, const Colorizer& colorizer);
+
+    // What anti-aliasing the last exportImage() did
+    AdaptiveSampler::Statistics getAntialiasingStatistics() const;
+
+    // Writes a heatmap of what each pixel cost instead of the fractal: black
+    // for a single iteration through red and yellow to white at the limit,
+    // on a log scale. Measures the whole image into cost.
+    void exportCostMap(const std::string& path, TileCost& cost);
+
+    // Writes the smoothed iteration counts as native 32-bit floats
+    void exportRaw(const std::string& path);
+
+    // Bytes held by the pipeline at its peak
+    size_t getPeakBytes(bool colorized) const;
+
+private:
+    // Bands waiting to be written, on top of the one rendering
+    static const int BANDS_IN_FLIGHT = 2;
+
+    Tile::Bounds m_bounds;
+    int m_width;
+    int m_height;
+    int m_bandRows;
+
+    int m_maxSamples;
+    double m_sampleBudget;
+    AdaptiveSampler::Statistics m_antialiasing;
+
+    struct Band {
+        int firstRow;
+        int rows;
+        float* depth;
+    };
+
+    // Renders every band in order, handing each one to write on another thread
+    template <typename WriteBand>
+    void run(WriteBand writeBand);
+};
@@ -1,34 +1,64 @@
 #include "Tile.h"
 
-#include <GL/glew.h>
+#include "IterationLimit.h"
+#include "TileCost.h"
+#include "TileTextureArray.h"
+#include "Trace.h"
 
-#include <cstring>
+#include <algorithm>
 #include <assert.h>
+#include <math.h>
 
 
+// Tiles are only created on the main thread
+static long long s_nextId = 0;
+
 Tile::Tile(Bounds bounds, int generation):
+    m_id(s_nextId++),
     m_state(State::INIT),
     m_bounds(bounds),
     m_generation(generation),
-    m_texture(NULL),
-    m_cachedTexture(nullptr)
+    m_textures(nullptr),
+    m_textureLayer(-1),
+    m_solid(false),
+    m_sampleStride(0),
+    m_cachedTexture(nullptr),
+    m_predictedIterations(-1.0),
+    m_parent(nullptr)
 {
 
 }
 
 Tile::Tile(double left, double right, double top, double bottom, int maxIt, int generation) :
+    m_id(s_nextId++),
     m_state(State::INIT),
     m_bounds{ (float)left, (float)right, (float)top, (float)bottom, (float)maxIt },
     m_generation(generation),
-    m_texture(NULL),
-    m_cachedTexture(nullptr)
+    m_textures(nullptr),
+    m_textureLayer(-1),
+    m_solid(false),
+    m_sampleStride(0),
+    m_cachedTexture(nullptr),
+    m_predictedIterations(-1.0),
+    m_parent(nullptr)
 {
 
 }
 
 Tile::~Tile()
 {
-    glDeleteTextures(1, &m_texture);
+    if (m_textures) {
+        m_textures->freeLayer(m_textureLayer);
+    }
+
+    if (m_parent) {
+        auto& siblings = m_parent->m_children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+    }
+
+    for (auto child : m_children) {
+        child->m_parent = nullptr;
+    }
 }
 
 Tile::State Tile::getState() const
@@ -36,42 +66,41 @@ Tile::State Tile::getState() const
     return m_state;
 }
 
-void Tile::createTexture()
+bool Tile::createTexture(TileTextureArray& textures)
 {
     assert(m_state == State::INIT);
-    assert(m_texture == NULL);
+    assert(m_textures == nullptr);
+    assert(textures.getSize() == TEXTURE_SIZE);
 
-    auto buffer = new float[TEXTURE_SIZE * TEXTURE_SIZE];
-    // IEEE says the pattern for 0.0f is all zeros
-    memset(buffer, 0, TEXTURE_SIZE * TEXTURE_SIZE * sizeof(float));
+    Trace::Span span("createTexture", m_id, m_generation);
 
-    createTexture(buffer);
+    int layer = textures.allocateLayer();
+    if (layer < 0) return false;
 
-    delete[] buffer;
+    m_textures = &textures;
+    m_textureLayer = layer;
     m_state = State::EMPTY;
+    return true;
 }
 
-//void Tile::reloadTexture()
-//{
-//    assert(m_state == State::UNLOADED);
-//    assert(m_texture == NULL);
-//    assert(m_cachedTexture != nullptr);
-//
-//    createTexture(m_cachedTexture);
-//
-//    m_state = State::ACTIVE;
-//}
-
-//void Tile::unloadTexture()
-//{
-//    assert(m_state == State::ACTIVE || m_state == State::SPLIT);
-//
-//    // TODO read back the buffer data
-//    
-//
-//
-//    //m_state = State::UNLOADED;
-//}
+void Tile::unloadTexture()
+{
+    assert(m_state == State::ACTIVE);
+    assert(!m_solid);
+    assert(m_textures != nullptr);
+
+    m_textures->freeLayer(m_textureLayer);
+    m_textures = nullptr;
+    m_textureLayer = -1;
+    m_sampleStride = 0;
+    m_state = State::UNLOADED;
+}
+
+void Tile::reloadTexture()
+{
+    assert(m_state == State::UNLOADED);
+    m_state = State::INIT;
+}
 
 void Tile::setRendering()
 {
@@ -83,6 +112,32 @@ void Tile::setRendered()
 {
     assert(m_state == State::RENDERING);
     m_state = State::ACTIVE;
+    m_sampleStride = 1;
+}
+
+void Tile::setPreview(int stride)
+{
+    assert(m_state == State::RENDERING);
+    assert(stride > 1);
+    m_sampleStride = stride;
+}
+
+int Tile::getSampleStride() const
+{
+    return m_sampleStride;
+}
+
+void Tile::setSolid()
+{
+    assert(m_state == State::INIT);
+    m_solid = true;
+    m_state = State::ACTIVE;
+    m_sampleStride = 1;
+}
+
+bool Tile::isSolid() const
+{
+    return m_solid;
 }
 
 Tile::Bounds Tile::getBounds() const
@@ -90,9 +145,10 @@ Tile::Bounds Tile::getBounds() const
     return m_bounds;
 }
 
-std::vector<Tile*> Tile::split()
+std::vector<Tile*> Tile::split(bool adaptiveIterations)
 {
     assert(m_state == State::ACTIVE);
+    assert(!m_solid);
     assert(m_children.empty());
 
     //std::vector<Tile*> newTiles;
@@ -100,10 +156,24 @@ std::vector<Tile*> Tile::split()
     float centerX = (m_bounds.left + m_bounds.right) / 2;
     float centerY = (m_bounds.top + m_bounds.bottom) / 2;
 
-    m_children.emplace_back(new Tile(m_bounds.left, centerX, m_bounds.top, centerY, m_bounds.maxIt, m_generation + 1));
-    m_children.emplace_back(new Tile(centerX, m_bounds.right, m_bounds.top, centerY, m_bounds.maxIt, m_generation + 1));
-    m_children.emplace_back(new Tile(m_bounds.left, centerX, centerY, m_bounds.bottom, m_bounds.maxIt, m_generation + 1));
-    m_children.emplace_back(new Tile(centerX, m_bounds.right, centerY, m_bounds.bottom, m_bounds.maxIt, m_generation + 1));
+    float maxIt = m_bounds.maxIt;
+    if (adaptiveIterations && m_cost) {
+        maxIt = IterationLimit::forChildren(m_bounds, *m_cost, m_generation + 1);
+    }
+
+    m_children.emplace_back(new Tile(Bounds{ m_bounds.left, centerX, m_bounds.top, centerY, maxIt }, m_generation + 1));
+    m_children.emplace_back(new Tile(Bounds{ centerX, m_bounds.right, m_bounds.top, centerY, maxIt }, m_generation + 1));
+    m_children.emplace_back(new Tile(Bounds{ m_bounds.left, centerX, centerY, m_bounds.bottom, maxIt }, m_generation + 1));
+    m_children.emplace_back(new Tile(Bounds{ centerX, m_bounds.right, centerY, m_bounds.bottom, maxIt }, m_generation + 1));
+
+    for (auto child : m_children) {
+        child->m_parent = this;
+
+        if (m_cost) {
+            double pixels = (double)child->getTextureSize() * child->getTextureSize();
+            child->m_predictedIterations = m_cost->predictIterations(m_bounds, child->m_bounds, pixels, maxIt);
+        }
+    }
 
     m_state = State::SPLIT;
 
@@ -116,109 +186,88 @@ bool Tile::childrenAreRendered() const
         return false;
 
     for (auto tile : m_children) {
-        if (tile->getState() < State::ACTIVE) return false;
+        if (tile->getState() < State::ACTIVE || tile->getState() == State::UNLOADED) return false;
     }
     
     return true;
 }
 
-GLuint Tile::getTexture() const
+const Tile* Tile::getParent() const
 {
-    assert(m_state >= State::INIT && m_state <= State::SPLIT);
-
-    return m_texture;
+    return m_parent;
 }
 
-int Tile::getTextureSize() const
+bool Tile::isCoveredByChildren() const
 {
-    return TEXTURE_SIZE;
+    if (m_state != State::SPLIT || m_children.size() != 4)
+        return false;
+
+    return childrenAreRendered();
 }
 
-void Tile::getVertexData(GLfloat * buffer) const
-{
-    assert(m_state >= State::INIT && m_state <= State::SPLIT);
-
-    // Bottom left
-    buffer[0] = (float)m_bounds.left;
-    buffer[1] = (float)m_bounds.bottom;
-    buffer[2] = m_generation / 10.f;
-    // Top left
-    buffer[3] = (float)m_bounds.left;
-    buffer[4] = (float)m_bounds.top;
-    buffer[5] = m_generation / 10.f;
-    // Top right
-    buffer[6] = (float)m_bounds.right;
-    buffer[7] = (float)m_bounds.top;
-    buffer[8] = m_generation / 10.f;
-
-    // Bottom left
-    buffer[9] = (float)m_bounds.left;
-    buffer[10] = (float)m_bounds.bottom;
-    buffer[11] = m_generation / 10.f;
-    // Top right
-    buffer[12] = (float)m_bounds.right;
-    buffer[13] = (float)m_bounds.top;
-    buffer[14] = m_generation / 10.f;
-    // Bottom right
-    buffer[15] = (float)m_bounds.right;
-    buffer[16] = (float)m_bounds.bottom;
-    buffer[17] = m_generation / 10.f;
-
-}
-
-void Tile::getUvData(GLfloat * buffer) const
-{
-    assert(m_state >= State::INIT && m_state <= State::SPLIT);
-
-    static const GLfloat g_uv_buffer_data[] = {
-
-        // Top left
-        0.f, 1.f,
-        // Bottom left
-        0.f, 0.f,
-        // Bottom right
-        1.f, 0.f,
-
-        // Top left
-        0.f, 1.f,
-        // Bottom right
-        1.f, 0.f,
-        // Top right
-        1.f, 1.f,
-    };
+int Tile::getGeneration() const
+{
+    return m_generation;
+}
 
-    memcpy(buffer, g_uv_buffer_data, sizeof(GLfloat) * 12);
+long long Tile::getId() const
+{
+    return m_id;
 }
 
-void Tile::createTexture(float * buffer)
+GLuint Tile::getTexture() const
 {
-    assert(m_state == State::INIT /*|| m_state == State::UNLOADED*/);
-    assert(m_texture == NULL);
+    assert(m_state >= State::EMPTY && m_state <= State::SPLIT);
 
-    glGenTextures(1, &m_texture);
+    return m_textures->getTexture();
+}
 
-    // Fill the texture with 0
+int Tile::getTextureLayer() const
+{
+    assert(m_state >= State::EMPTY && m_state <= State::SPLIT);
 
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    return m_textureLayer;
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, TEXTURE_SIZE, TEXTURE_SIZE, 0, GL_RED, GL_FLOAT, buffer);
+int Tile::getTextureSize() const
+{
+    return TEXTURE_SIZE;
+}
 
-    // Not sure about this stuff
-    // ... nice trilinear filtering ...
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    // This can't be GL_NEAREST_MIPMAP_*, but what about GL_LINEAR?
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    // ... which requires mipmaps. Generate them automatically.
-    //glGenerateMipmap(GL_TEXTURE_2D);
+const TileCost* Tile::getCost() const
+{
+    return m_cost.get();
+}
 
+void Tile::setCost(std::shared_ptr<const TileCost> cost)
+{
+    m_cost = std::move(cost);
+}
 
-    // Unbind the texture? Is this needed?
-    glBindTexture(GL_TEXTURE_2D, 0);
+double Tile::getPredictedIterations() const
+{
+    return m_predictedIterations;
+}
 
-    // Not sure what this would do here, but it's in the example
-    glFinish();
+void Tile::getInstanceData(GLfloat * buffer) const
+{
+    assert(m_state >= State::EMPTY && m_state <= State::SPLIT);
+
+    buffer[0] = m_bounds.left;
+    buffer[1] = m_bounds.right;
+    buffer[2] = m_bounds.top;
+    buffer[3] = m_bounds.bottom;
+    // A preview's texels are as coarse as those of the generation log2(stride)
+    // up, and it goes half a step behind that. Stays inside the clip volume
+    // for the first 251 generations, far more than float bounds can resolve.
+    float level = (float)m_generation + 1;
+    if (m_sampleStride > 1) {
+        level -= log2f((float)m_sampleStride) + 0.5f;
+    }
+    buffer[4] = 1.f - (level + PREVIEW_LEVELS) / 128.f;
+    buffer[5] = (float)m_textureLayer;
+    buffer[6] = m_bounds.maxIt;
+    buffer[7] = (float)m_sampleStride;
 }
 
 bool inside(const Tile::Bounds & tile, const Tile::Bounds & view)
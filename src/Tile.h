@@ -3,20 +3,31 @@
 typedef unsigned int GLuint;
 typedef float GLfloat;
 
+#include <memory>
 #include <vector>
 
+class TileCost;
+class TileTextureArray;
+
 class Tile {
 public:
     enum class State {
         INIT,       // The Tile object has been created, nothing more
-        EMPTY,      // The texture has been allocated on the GPU
+        EMPTY,      // A layer of the texture array has been allocated on the GPU
         RENDERING,  // OpenCL is rendering the texture
         ACTIVE,     // The texture is being shown, but is not necessarily in view
         SPLIT,      // The texture has been split into four smaller textures, but is still active
                     // After the children are done rendering, it can be unloaded
-        //UNLOADED,   // The texture has been removed from the GPU and cached in the heap
+        UNLOADED,   // The texture has been freed for other tiles, the tile waits to come back into view
     };
 
+    // Width and height of every tile's texture
+    static const int TEXTURE_SIZE = 4096;
+
+    // Depth levels kept free behind the root, for previews with strides up
+    // to 2^(PREVIEW_LEVELS - 1)
+    static const int PREVIEW_LEVELS = 4;
+
     struct Bounds {
         float left;
         float right;
@@ -31,49 +42,96 @@ public:
 
     State getState() const;
     
-    // Allocates an empty texture on the GPU
+    // Allocates a layer of the texture array for this tile
+    // Returns false, staying in INIT, if every layer is in use
     // INIT -> EMPTY
-    void createTexture();
+    bool createTexture(TileTextureArray& textures);
 
-    //// Allocates the texture on the GPU and loads the cached data
-    //// UNLOADED -> ACTIVE
-    //void reloadTexture();
+    // Frees the texture's layer. The tile keeps its place in the tree, so
+    // its part of the plane can be rendered again. Not for solid tiles.
+    // ACTIVE -> UNLOADED
+    void unloadTexture();
 
-    //// Caches the texture data on the heap and deallocates the texture on the GPU
-    //void unloadTexture();
+    // Makes an unloaded tile ready to be queued for rendering again
+    // UNLOADED -> INIT
+    void reloadTexture();
 
     void setRendering();
     void setRendered();
 
+    // A pass of a progressive render is in the texture: the samples on
+    // every stride-th texel of every stride-th row, packed into the top left
+    // size / stride texels square. See CpuKernel::renderPass().
+    // Only while RENDERING
+    void setPreview(int stride);
+
+    // Texels between the samples the texture holds: 1 once rendered, more
+    // while only a pass of a progressive render is in, 0 if nothing is
+    int getSampleStride() const;
+
+    // The whole tile is inside the set, so it is shown as a constant
+    // instead of a texture, and never split
+    // INIT -> ACTIVE
+    void setSolid();
+    bool isSolid() const;
+
     Bounds getBounds() const;
 
-    // Splits the tile into four new tiles
+    // Splits the tile into four new tiles. With adaptiveIterations, and a
+    // cost to go by, they get their maxIt from IterationLimit, otherwise this
+    // tile's. Solid tiles can't be split.
     // ACTIVE -> SPLIT
-    std::vector<Tile*> split();
+    std::vector<Tile*> split(bool adaptiveIterations);
     
     bool childrenAreRendered() const;
 
+    // Null once the parent has been deleted
+    const Tile* getParent() const;
+
+    // True if all four children are rendered, so none of this tile shows
+    bool isCoveredByChildren() const;
+
+    int getGeneration() const;
+
+    // Unique for the life of the program, to follow a tile through traces
+    long long getId() const;
+
+    // The texture array holding this tile's layer
     GLuint getTexture() const;
+    int getTextureLayer() const;
 
     int getTextureSize() const;
 
-    // Fill 18 float values, 2 triangles * 3 points * 3 coordinates
-    void getVertexData(GLfloat* buffer) const;
-    // Fill 12 float values, 2 triangles * 3 points * 2 coordinates
-    void getUvData(GLfloat* buffer) const;
+    // Where this tile's iterations went, null if its backend doesn't count them
+    const TileCost* getCost() const;
+    void setCost(std::shared_ptr<const TileCost> cost);
 
-private:
-    static const int TEXTURE_SIZE = 4096;
+    // Iterations rendering this tile should take, from the parent's cost
+    // when it was split. Negative if there was nothing to predict from.
+    double getPredictedIterations() const;
+
+    // Fill 8 float values: left, right, top, bottom, depth, texture layer, maxIt, sample stride
+    // The layer is -1 for solid tiles
+    // Finer texels get a smaller depth, so they win the depth test: deeper
+    // generations, and a preview loses to a rendered tile as coarse as it
+    void getInstanceData(GLfloat* buffer) const;
 
+private:
+    long long m_id;
     State m_state;
     Bounds m_bounds;
     int m_generation;
-    mutable GLuint m_texture;
+    TileTextureArray* m_textures;
+    int m_textureLayer;
+    bool m_solid;
+    int m_sampleStride;
     float* m_cachedTexture;
+    std::shared_ptr<const TileCost> m_cost;
+    double m_predictedIterations;
+    // Either side may be deleted first, and lets the other one know
+    Tile* m_parent;
     std::vector<Tile*> m_children;
 
-    void createTexture(float* buffer);
-
 };
 
 bool inside(const Tile::Bounds& view, const Tile::Bounds& tile);
\ No newline at end of file
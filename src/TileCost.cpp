@@ -0,0 +1,274 @@
+#include "TileCost.h"
+
+#include "CpuKernel.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdexcept>
+#include <stdio.h>
+
+TileCost::TileCost(int width, int height, float maxIt) :
+    m_width(width),
+    m_height(height),
+    m_maxIt(maxIt),
+    m_totalIterations(0.0),
+    m_cellIterations(MAP_SIZE * MAP_SIZE, 0.0),
+    m_cellPixels(MAP_SIZE * MAP_SIZE, 0.0),
+    m_cellInterior(MAP_SIZE * MAP_SIZE, 0.0),
+    m_histogram(HISTOGRAM_BINS, 0.0),
+    m_minValue(FLT_MAX),
+    m_maxValue(-FLT_MAX),
+    m_interiorCount(0.0)
+{
+    assert(width > 0 && height > 0);
+}
+
+void TileCost::addRows(const float* values, int firstRow, int rows)
+{
+    assert(firstRow >= 0 && firstRow + rows <= m_height);
+
+    for (int y = firstRow; y < firstRow + rows; ++y) {
+        const float* row = values + (size_t)(y - firstRow) * m_width;
+        int cellRow = y * MAP_SIZE / m_height;
+
+        // A cell at a time, so there is no division per pixel. Pixel x is in
+        // column x * MAP_SIZE / m_width, as the OpenCL kernels count it.
+        for (int column = 0; column < MAP_SIZE; ++column) {
+            int first = (column * m_width + MAP_SIZE - 1) / MAP_SIZE;
+            int last = ((column + 1) * m_width + MAP_SIZE - 1) / MAP_SIZE;
+
+            double iterations = 0.0;
+            int interior = 0;
+            for (int x = first; x < last; ++x) {
+                float value = row[x];
+                if (value >= m_maxIt) {
+                    ++interior;
+                }
+                else {
+                    m_minValue = std::min(m_minValue, value);
+                    m_maxValue = std::max(m_maxValue, value);
+                }
+
+                double pixel = CpuKernel::getIterations(value, m_maxIt);
+                iterations += pixel;
+
+                int bin = pixel < 2.0 ? 0 : ilogb(pixel);
+                ++m_histogram[std::min(bin, HISTOGRAM_BINS - 1)];
+            }
+
+            m_cellIterations[cellRow * MAP_SIZE + column] += iterations;
+            m_cellPixels[cellRow * MAP_SIZE + column] += last - first;
+            m_cellInterior[cellRow * MAP_SIZE + column] += interior;
+            m_interiorCount += interior;
+            m_totalIterations += iterations;
+        }
+    }
+}
+
+void TileCost::merge(const TileCost& other)
+{
+    assert(other.m_width == m_width && other.m_height == m_height);
+
+    for (size_t i = 0; i < m_cellIterations.size(); ++i) {
+        m_cellIterations[i] += other.m_cellIterations[i];
+        m_cellPixels[i] += other.m_cellPixels[i];
+        m_cellInterior[i] += other.m_cellInterior[i];
+    }
+    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
+        m_histogram[bin] += other.m_histogram[bin];
+    }
+    m_totalIterations += other.m_totalIterations;
+    addRange(other.m_minValue, other.m_maxValue, other.m_interiorCount);
+}
+
+void TileCost::addCell(int column, int row, double iterations, double pixels, double interiorPixels)
+{
+    assert(column >= 0 && column < MAP_SIZE && row >= 0 && row < MAP_SIZE);
+
+    m_cellIterations[row * MAP_SIZE + column] += iterations;
+    m_cellPixels[row * MAP_SIZE + column] += pixels;
+    m_cellInterior[row * MAP_SIZE + column] += interiorPixels;
+    m_totalIterations += iterations;
+}
+
+void TileCost::addHistogram(int bin, double pixels)
+{
+    m_histogram[std::min(bin, HISTOGRAM_BINS - 1)] += pixels;
+}
+
+void TileCost::addRange(float minValue, float maxValue, double interiorPixels)
+{
+    m_minValue = std::min(m_minValue, minValue);
+    m_maxValue = std::max(m_maxValue, maxValue);
+    m_interiorCount += interiorPixels;
+}
+
+double TileCost::getPixelCount() const
+{
+    double pixels = 0.0;
+    for (double cell : m_cellPixels) {
+        pixels += cell;
+    }
+    return pixels;
+}
+
+double TileCost::getTotalIterations() const
+{
+    return m_totalIterations;
+}
+
+double TileCost::getCellIterations(int column, int row) const
+{
+    int cell = row * MAP_SIZE + column;
+    return m_cellPixels[cell] > 0.0 ? m_cellIterations[cell] / m_cellPixels[cell] : 0.0;
+}
+
+std::vector<float> TileCost::getMap() const
+{
+    std::vector<float> map(MAP_SIZE * MAP_SIZE);
+    for (int row = 0; row < MAP_SIZE; ++row) {
+        for (int column = 0; column < MAP_SIZE; ++column) {
+            map[row * MAP_SIZE + column] = (float)getCellIterations(column, row);
+        }
+    }
+    return map;
+}
+
+const std::vector<double>& TileCost::getHistogram() const
+{
+    return m_histogram;
+}
+
+float TileCost::getMinValue() const
+{
+    return m_minValue;
+}
+
+float TileCost::getMaxValue() const
+{
+    return m_maxValue;
+}
+
+double TileCost::getInteriorCount() const
+{
+    return m_interiorCount;
+}
+
+float TileCost::getMaxIt() const
+{
+    return m_maxIt;
+}
+
+double TileCost::predictIterations(const Tile::Bounds& bounds, const Tile::Bounds& region, double pixels, float maxIt) const
+{
+    // The region in cells, clamped to the map
+    auto toCells = [](float value, float from, float to) {
+        return std::min(std::max((value - from) / (to - from), 0.f), 1.f) * MAP_SIZE;
+    };
+    float left = toCells(region.left, bounds.left, bounds.right);
+    float right = toCells(region.right, bounds.left, bounds.right);
+    float top = toCells(region.top, bounds.top, bounds.bottom);
+    float bottom = toCells(region.bottom, bounds.top, bounds.bottom);
+
+    double iterations = 0.0;
+    double area = 0.0;
+
+    for (int row = (int)top; row < MAP_SIZE && row < bottom; ++row) {
+        float height = std::min(bottom, row + 1.f) - std::max(top, (float)row);
+
+        for (int column = (int)left; column < MAP_SIZE && column < right; ++column) {
+            float width = std::min(right, column + 1.f) - std::max(left, (float)column);
+            int cell = row * MAP_SIZE + column;
+            if (width <= 0.f || height <= 0.f || m_cellPixels[cell] == 0.0) continue;
+
+            // Interior pixels cost the limit, whichever it is
+            double exterior = m_cellIterations[cell] - m_cellInterior[cell] * m_maxIt;
+            double cellIterations = exterior + m_cellInterior[cell] * maxIt;
+
+            iterations += cellIterations / m_cellPixels[cell] * width * height;
+            area += width * height;
+        }
+    }
+
+    if (area == 0.0) return -1.0;
+
+    return iterations / area * pixels;
+}
+
+bool TileCost::isInterior(const Tile::Bounds& bounds, const Tile::Bounds& region) const
+{
+    auto toCell = [](float value, float from, float to) {
+        return std::min(std::max((int)floorf((value - from) / (to - from) * MAP_SIZE), 0), MAP_SIZE - 1);
+    };
+    int firstColumn = toCell(region.left, bounds.left, bounds.right);
+    int lastColumn = toCell(region.right, bounds.left, bounds.right);
+    int firstRow = toCell(region.top, bounds.top, bounds.bottom);
+    int lastRow = toCell(region.bottom, bounds.top, bounds.bottom);
+
+    // A region ending on a cell edge doesn't overlap the next cell
+    if (lastColumn > firstColumn && (region.right - bounds.left) / (bounds.right - bounds.left) * MAP_SIZE <= lastColumn) --lastColumn;
+    if (lastRow > firstRow && (region.bottom - bounds.top) / (bounds.bottom - bounds.top) * MAP_SIZE <= lastRow) --lastRow;
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            int cell = row * MAP_SIZE + column;
+            if (m_cellPixels[cell] == 0.0 || m_cellInterior[cell] < m_cellPixels[cell]) return false;
+        }
+    }
+
+    return true;
+}
+
+void TileCost::writeJson(const std::string& path, const std::vector<Record>& records)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    auto writeArray = [file](const char* name, const double* values, size_t count) {
+        fprintf(file, ", \"%s\": [", name);
+        for (size_t i = 0; i < count; ++i) {
+            fprintf(file, i == 0 ? "%.6g" : ", %.6g", values[i]);
+        }
+        fprintf(file, "]");
+    };
+
+    fprintf(file, "{\"mapSize\": %d, \"histogramBins\": %d, \"tiles\": [\n", MAP_SIZE, HISTOGRAM_BINS);
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record& record = records[i];
+
+        fprintf(file, "{\"id\": %lld, \"generation\": %d, \"bounds\": [%.9g, %.9g, %.9g, %.9g], \"maxIt\": %g, \"seconds\": %.6f",
+            record.id, record.generation,
+            record.bounds.left, record.bounds.right, record.bounds.top, record.bounds.bottom, record.bounds.maxIt,
+            record.seconds);
+
+        if (record.predictedIterations >= 0.0) {
+            fprintf(file, ", \"predictedIterations\": %.6g", record.predictedIterations);
+        }
+        if (record.iterations >= 0.0) {
+            fprintf(file, ", \"iterations\": %.6g, \"interiorPixels\": %.0f", record.iterations, record.interiorPixels);
+        }
+        if (record.minValue <= record.maxValue) {
+            fprintf(file, ", \"minValue\": %.6g, \"maxValue\": %.6g", record.minValue, record.maxValue);
+        }
+        if (!record.histogram.empty()) {
+            writeArray("histogram", record.histogram.data(), record.histogram.size());
+        }
+        if (!record.map.empty()) {
+            std::vector<double> map(record.map.begin(), record.map.end());
+            writeArray("map", map.data(), map.size());
+        }
+
+        fprintf(file, "}%s\n", i + 1 < records.size() ? "," : "");
+    }
+
+    fprintf(file, "]}\n");
+
+    if (fclose(file) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
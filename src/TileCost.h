@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Tile.h"
+
+#include <string>
+#include <vector>
+
+// Where the iterations of a rendered image went: a coarse map of the mean
+// iterations per pixel, and a histogram of per-pixel iteration counts.
+// Rendering cost is almost entirely iterations, so a tile's map predicts
+// what rendering any part of it again, at any resolution, will cost.
+// Also keeps the range of the values outside the set, and how many pixels
+// are inside it.
+//
+// The kernels fill these in while they render: each CPU thread measures
+// its rows into its own TileCost, which are merged at the end, and the
+// OpenCL kernels reduce per work-group and hand back the totals.
+class TileCost {
+public:
+    // Cells across and down the map
+    static const int MAP_SIZE = 16;
+    // Bin b counts pixels which took [2^b, 2^(b+1)) iterations, the last
+    // bin everything above
+    static const int HISTOGRAM_BINS = 20;
+
+    // Nothing measured yet, for a width x height image
+    TileCost(int width, int height, float maxIt);
+
+    // Adds rows [firstRow, firstRow + rows) of the image
+    void addRows(const float* values, int firstRow, int rows);
+
+    // Adds what another TileCost of the same image measured
+    void merge(const TileCost& other);
+
+    // For measurements made elsewhere, like the OpenCL kernels
+    void addCell(int column, int row, double iterations, double pixels, double interiorPixels);
+    void addHistogram(int bin, double pixels);
+    void addRange(float minValue, float maxValue, double interiorPixels);
+
+    double getPixelCount() const;
+
+    double getTotalIterations() const;
+
+    // Mean iterations per pixel in a cell, 0 where nothing was measured
+    double getCellIterations(int column, int row) const;
+
+    // Per cell, row by row
+    std::vector<float> getMap() const;
+
+    // Pixels per bin
+    const std::vector<double>& getHistogram() const;
+
+    // Smallest and largest value outside the set. Only meaningful when
+    // some pixels are outside, min is above max otherwise.
+    float getMinValue() const;
+    float getMaxValue() const;
+
+    // Pixels which reached maxIt
+    double getInteriorCount() const;
+
+    // The limit the image was rendered with
+    float getMaxIt() const;
+
+    // Iterations a render of pixels pixels covering region, with a limit of
+    // maxIt, would take, where this measured an image covering bounds.
+    // Interior pixels are priced at the new limit. Negative if region
+    // doesn't overlap the measured part.
+    double predictIterations(const Tile::Bounds& bounds, const Tile::Bounds& region, double pixels, float maxIt) const;
+
+    // True if every pixel measured in the cells region overlaps reached
+    // maxIt, where this measured an image covering bounds
+    bool isInterior(const Tile::Bounds& bounds, const Tile::Bounds& region) const;
+
+    // One rendered tile, as TileScheduler logs it
+    struct Record {
+        long long id;
+        int generation;
+        Tile::Bounds bounds;
+        double seconds;
+        double predictedIterations;    // Negative if there was no prediction
+        double iterations;             // Negative if not counted
+        float minValue;
+        float maxValue;
+        double interiorPixels;
+        std::vector<double> histogram; // Empty if not counted
+        std::vector<float> map;        // Mean iterations per cell, row by row
+    };
+
+    // Throws std::runtime_error if the file can't be written
+    static void writeJson(const std::string& path, const std::vector<Record>& records);
+
+private:
+    int m_width;
+    int m_height;
+    float m_maxIt;
+    double m_totalIterations;
+    std::vector<double> m_cellIterations;
+    std::vector<double> m_cellPixels;
+    std::vector<double> m_cellInterior;
+    std::vector<double> m_histogram;
+    float m_minValue;
+    float m_maxValue;
+    double m_interiorCount;
+};
@@ -0,0 +1,274 @@
+#include "TileScheduler.h"
+
+#include "Tile.h"
+#include "TileTextureArray.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <limits>
+
+TileScheduler::TileScheduler(TileTextureArray& textures) :
+    m_textures(textures),
+    m_completedBytes(0),
+    m_completedIterations(0.0),
+    m_countedPixels(0.0),
+    m_recordCosts(false)
+{
+}
+
+void TileScheduler::addBackend(std::unique_ptr<RenderBackend> backend)
+{
+    std::cout << "Render backend: " << backend->getName() << "\n";
+
+    m_backends.push_back({ std::move(backend), 0.0, 0.0, 0 });
+}
+
+void TileScheduler::enqueue(Tile* tile)
+{
+    assert(tile->getState() == Tile::State::INIT);
+
+    m_queue.push_back(tile);
+}
+
+void TileScheduler::prioritize(const std::function<bool(const Tile*)>& urgent)
+{
+    std::stable_partition(std::begin(m_queue), std::end(m_queue), urgent);
+}
+
+void TileScheduler::update()
+{
+    for (auto& backend : m_backends) {
+        collectCompleted(backend);
+    }
+
+    dispatch();
+}
+
+int TileScheduler::getBackendCount() const
+{
+    return (int)m_backends.size();
+}
+
+int TileScheduler::getQueuedCount() const
+{
+    return (int)m_queue.size();
+}
+
+int TileScheduler::getPendingCount() const
+{
+    int pending = 0;
+    for (const auto& backend : m_backends) {
+        pending += backend.renderer->getPendingCount();
+    }
+    return pending;
+}
+
+int TileScheduler::getCompletedCount() const
+{
+    int completed = 0;
+    for (const auto& backend : m_backends) {
+        completed += backend.completedTiles;
+    }
+    return completed;
+}
+
+unsigned long long TileScheduler::getCompletedBytes() const
+{
+    return m_completedBytes;
+}
+
+double TileScheduler::getCompletedIterations() const
+{
+    return m_completedIterations;
+}
+
+double TileScheduler::getEstimatedSeconds() const
+{
+    double iterationsPerSecond = 0.0;
+    double iterations = 0.0;
+    for (const auto& backend : m_backends) {
+        iterationsPerSecond += backend.iterationsPerSecond;
+        iterations += backend.pendingIterations;
+    }
+
+    if (iterationsPerSecond == 0.0) return -1.0;
+
+    for (auto tile : m_queue) {
+        iterations += getExpectedIterations(tile);
+    }
+
+    return iterations / iterationsPerSecond;
+}
+
+void TileScheduler::setRecordCosts(bool enabled)
+{
+    m_recordCosts = enabled;
+}
+
+const std::vector<TileCost::Record>& TileScheduler::getCostRecords() const
+{
+    return m_costRecords;
+}
+
+double TileScheduler::getExpectedIterations(const Tile* tile) const
+{
+    double predicted = tile->getPredictedIterations();
+    if (predicted >= 0.0) return predicted;
+
+    double pixels = (double)tile->getTextureSize() * tile->getTextureSize();
+    double perPixel = m_countedPixels > 0.0 ? m_completedIterations / m_countedPixels : DEFAULT_ITERATIONS_PER_PIXEL;
+    return pixels * perPixel;
+}
+
+void TileScheduler::collectCompleted(Backend& backend)
+{
+    for (auto completed : backend.renderer->checkPendingRenders()) {
+        if (Trace::isEnabled()) {
+            // Ends now, though it may have finished since the last check
+            long long end = Trace::now();
+            Trace::addSpan("render", end - (long long)(completed.seconds * 1e9), end,
+                { completed.tile->getId(), completed.tile->getGeneration(), completed.iterations });
+        }
+
+        auto expected = m_expectedIterations.find(completed.tile);
+        assert(expected != m_expectedIterations.end());
+        double expectedIterations = expected->second;
+        m_expectedIterations.erase(expected);
+
+        double pixels = (double)completed.tile->getTextureSize() * completed.tile->getTextureSize();
+        backend.pendingIterations -= expectedIterations;
+        ++backend.completedTiles;
+        m_completedBytes += (unsigned long long)pixels * sizeof(float);
+        if (completed.iterations >= 0.0) {
+            m_completedIterations += completed.iterations;
+            m_countedPixels += pixels;
+        }
+
+        if (m_recordCosts) {
+            const TileCost* cost = completed.tile->getCost();
+            m_costRecords.push_back({
+                completed.tile->getId(),
+                completed.tile->getGeneration(),
+                completed.tile->getBounds(),
+                completed.seconds,
+                completed.tile->getPredictedIterations(),
+                completed.iterations,
+                cost ? cost->getMinValue() : 0.f,
+                cost ? cost->getMaxValue() : -1.f,
+                cost ? cost->getInteriorCount() : 0.0,
+                cost ? cost->getHistogram() : std::vector<double>(),
+                cost ? cost->getMap() : std::vector<float>()
+            });
+        }
+
+        if (completed.seconds <= 0.0) continue;
+
+        // Backends which don't count iterations are measured by the expected ones
+        double iterations = completed.iterations >= 0.0 ? completed.iterations : expectedIterations;
+        double measured = iterations / completed.seconds;
+        if (backend.iterationsPerSecond == 0.0) {
+            backend.iterationsPerSecond = measured;
+        }
+        else {
+            backend.iterationsPerSecond += THROUGHPUT_SMOOTHING * (measured - backend.iterationsPerSecond);
+        }
+    }
+
+    if (backend.renderer->getPendingCount() == 0) {
+        // Don't let rounding accumulate while the backend is idle
+        backend.pendingIterations = 0.0;
+    }
+}
+
+void TileScheduler::dispatch()
+{
+    if (m_backends.empty()) return;
+
+    Trace::Span span("dispatch");
+
+    // Plan the whole queue in order, as if every tile were handed out now:
+    // each tile goes to the backend which would finish it first. Only the
+    // tiles at the front of each backend's plan are actually sent, so the
+    // rest can still move once the throughput estimates improve.
+    std::vector<double> busySeconds(m_backends.size());
+    std::vector<int> capacity(m_backends.size());
+    std::vector<int> freeSlots(m_backends.size());
+    std::vector<bool> deferred(m_backends.size(), false);
+    std::vector<std::vector<Tile*>> batches(m_backends.size());
+
+    for (size_t b = 0; b < m_backends.size(); ++b) {
+        const auto& backend = m_backends[b];
+        capacity[b] = MAX_IN_FLIGHT_BATCHES * backend.renderer->getMaxBatchSize();
+        freeSlots[b] = capacity[b] - backend.renderer->getPendingCount();
+        busySeconds[b] = backend.iterationsPerSecond > 0.0 ? backend.pendingIterations / backend.iterationsPerSecond : 0.0;
+    }
+
+    for (auto it = std::begin(m_queue); it != std::end(m_queue); /*Nothing*/) {
+        Tile* tile = *it;
+        double iterations = getExpectedIterations(tile);
+
+        int best = -1;
+        double bestFinish = std::numeric_limits<double>::max();
+
+        for (size_t b = 0; b < m_backends.size(); ++b) {
+            const auto& backend = m_backends[b];
+
+            double finish;
+            if (backend.iterationsPerSecond > 0.0) {
+                finish = busySeconds[b] + iterations / backend.iterationsPerSecond;
+            }
+            else if (backend.renderer->getPendingCount() == 0 && freeSlots[b] == capacity[b]) {
+                // Never measured and idle: give it one tile to measure
+                finish = 0.0;
+            }
+            else {
+                // Still measuring its first tile
+                continue;
+            }
+
+            if (finish < bestFinish) {
+                bestFinish = finish;
+                best = (int)b;
+            }
+        }
+
+        if (best < 0) break;
+
+        auto& backend = m_backends[best];
+        if (backend.iterationsPerSecond > 0.0) {
+            busySeconds[best] = bestFinish;
+        }
+
+        if (deferred[best] || freeSlots[best] <= 0) {
+            // Planned for a busy backend; it stays queued to keep the order
+            deferred[best] = true;
+            ++it;
+            continue;
+        }
+
+        if (!tile->createTexture(m_textures)) {
+            // Out of texture layers until some tiles are deleted
+            break;
+        }
+
+        batches[best].push_back(tile);
+        backend.pendingIterations += iterations;
+        m_expectedIterations[tile] = iterations;
+        --freeSlots[best];
+
+        it = m_queue.erase(it);
+    }
+
+    for (size_t b = 0; b < m_backends.size(); ++b) {
+        auto& renderer = m_backends[b].renderer;
+        const auto& planned = batches[b];
+        size_t batchSize = renderer->getMaxBatchSize();
+
+        for (size_t first = 0; first < planned.size(); first += batchSize) {
+            size_t last = std::min(first + batchSize, planned.size());
+            renderer->renderBatch(std::vector<Tile*>(planned.begin() + first, planned.begin() + last));
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "RenderBackend.h"
+#include "TileCost.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Tile;
+class TileTextureArray;
+
+// Hands tiles out to every available RenderBackend at once.
+//
+// Work is counted in iterations, which is nearly all a tile costs. A tile
+// is expected to take what its parent's cost map predicts for it, or else
+// the mean iterations per pixel of the tiles measured so far. The
+// throughput of each backend is learned from the tiles it completes.
+// A queued tile goes to the backend which would finish it first, counting
+// the work that backend already has, so all backends finish together
+// instead of one device collecting a backlog while the others sit idle.
+//
+// Tiles are given their texture layer when they are handed out, so tiles
+// wait in the queue while every layer is in use.
+class TileScheduler {
+public:
+    explicit TileScheduler(TileTextureArray& textures);
+
+    void addBackend(std::unique_ptr<RenderBackend> backend);
+
+    // Queues the tile for rendering. The tile must be in the INIT state.
+    void enqueue(Tile* tile);
+
+    // Moves the queued tiles for which urgent() is true to the front of the
+    // queue, keeping the order within both groups
+    void prioritize(const std::function<bool(const Tile*)>& urgent);
+
+    // Collects finished tiles and hands queued tiles to the backends
+    void update();
+
+    int getBackendCount() const;
+
+    // Tiles which haven't been handed to a backend yet
+    int getQueuedCount() const;
+
+    // Tiles handed to a backend which haven't completed yet
+    int getPendingCount() const;
+
+    // Tiles completed so far, and the texture bytes they filled
+    int getCompletedCount() const;
+    unsigned long long getCompletedBytes() const;
+    // Iterations of the completed tiles whose backend counts them
+    double getCompletedIterations() const;
+
+    // Seconds until every queued and pending tile is rendered, going by the
+    // expected iterations and the measured throughputs. Negative until a
+    // backend has completed a tile.
+    double getEstimatedSeconds() const;
+
+    // Keeps a TileCost::Record of every completed tile while on
+    void setRecordCosts(bool enabled);
+    const std::vector<TileCost::Record>& getCostRecords() const;
+
+private:
+    struct Backend {
+        std::unique_ptr<RenderBackend> renderer;
+        double iterationsPerSecond; // 0 until the first tile completes
+        double pendingIterations;   // Expected of the tiles handed to the renderer
+        int completedTiles;
+    };
+
+    // How many batches each backend may hold. Two keeps a device busy while
+    // the next batch is being set up, without committing tiles too early.
+    static const int MAX_IN_FLIGHT_BATCHES = 2;
+
+    // Weight of the newest measurement in the throughput average
+    static constexpr double THROUGHPUT_SMOOTHING = 0.3;
+
+    // Expected iterations per pixel before any tile has been measured
+    static constexpr double DEFAULT_ITERATIONS_PER_PIXEL = 100.0;
+
+    TileTextureArray& m_textures;
+    std::vector<Backend> m_backends;
+    std::deque<Tile*> m_queue;
+    unsigned long long m_completedBytes;
+    double m_completedIterations;
+    // Pixels of the completed tiles whose iterations were counted
+    double m_countedPixels;
+    // Expected iterations of the tiles handed to a backend
+    std::unordered_map<const Tile*, double> m_expectedIterations;
+    bool m_recordCosts;
+    std::vector<TileCost::Record> m_costRecords;
+
+    double getExpectedIterations(const Tile* tile) const;
+    void collectCompleted(Backend& backend);
+    void dispatch();
+};
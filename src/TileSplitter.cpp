@@ -1,12 +1,42 @@
 #include "TileSplitter.h"
 
+#include "CpuRenderer.h"
+#include "OpenClRenderer.h"
+#include "Trace.h"
+
 #include <iostream>
+#include <memory>
+
+// Only where the parent measured nothing but interior can a child's
+// outline pass the border check
+static bool mayBeInterior(const Tile* parent, const Tile* child)
+{
+    const TileCost* cost = parent->getCost();
+    return cost != nullptr && cost->isInterior(parent->getBounds(), child->getBounds());
+}
 
 TileSplitter::TileSplitter(const Camera& camera, Tile::Bounds initialTile) :
-    m_camera(camera)
+    m_camera(camera),
+    m_textures(Tile::TEXTURE_SIZE, TileTextureArray::getLayersForBudget(Tile::TEXTURE_SIZE, TEXTURE_BUDGET_BYTES)),
+    m_scheduler(m_textures),
+    m_cpuRenderer(nullptr),
+    m_reprojection(false),
+    m_splitLastFrame(false),
+    m_adaptiveIterations(true)
 {
+    try {
+        m_scheduler.addBackend(std::unique_ptr<RenderBackend>(new OpenClRenderer()));
+    }
+    catch (const std::exception& e) {
+        std::cout << "OpenCL unavailable: " << e.what() << "\n";
+    }
+
+    m_cpuRenderer = new CpuRenderer();
+    m_scheduler.addBackend(std::unique_ptr<RenderBackend>(m_cpuRenderer));
+
     m_tiles.emplace_back(new Tile(initialTile));
-    m_renderer.render(m_tiles[0]);
+    m_scheduler.enqueue(m_tiles[0]);
+    m_scheduler.update();
 }
 
 std::vector<Tile*> TileSplitter::getTiles() const
@@ -14,17 +44,29 @@ std::vector<Tile*> TileSplitter::getTiles() const
     return m_tiles;
 }
 
+const TileTextureArray& TileSplitter::getTextures() const
+{
+    return m_textures;
+}
+
 void TileSplitter::splitAsNeeded()
 {
-    m_renderer.checkPendingRenders();
+    Trace::Span span("splitAsNeeded");
+
+    m_scheduler.update();
+    collectBorderChecks();
 
     const auto viewBounds = m_camera.getBounds();
 
     // Split any tiles that are too close to pixelated
     std::vector<Tile*> newTiles;
+    // Waiting on their border check instead of a renderer
+    std::vector<Tile*> checkedTiles;
+    // Already in m_tiles
+    std::vector<Tile*> reloadedTiles;
 
     for (auto tile : m_tiles) {
-        if (tile->getState() != Tile::State::ACTIVE)
+        if (tile->getState() != Tile::State::ACTIVE || tile->isSolid())
             continue;
 
         const auto tileBounds = tile->getBounds();
@@ -36,15 +78,31 @@ void TileSplitter::splitAsNeeded()
 
 
         if (tileInside && pixelSize > 0.5) {
-            std::cout << "Splitting\n";
+            Trace::Span splitSpan("split", tile->getId(), tile->getGeneration());
 
-            auto splitTiles = tile->split();
+            auto splitTiles = tile->split(m_adaptiveIterations);
             for (auto splitTile : splitTiles) {
-                newTiles.emplace_back(splitTile);
+                if (mayBeInterior(tile, splitTile)) {
+                    m_cpuRenderer->checkBorder(splitTile);
+                    checkedTiles.emplace_back(splitTile);
+                }
+                else {
+                    newTiles.emplace_back(splitTile);
+                }
             }
         }
     }
 
+    // Unloaded tiles back in view are rendered again, along with the new ones
+    for (auto tile : m_tiles) {
+        if (tile->getState() == Tile::State::UNLOADED && inside(tile->getBounds(), viewBounds)) {
+            tile->reloadTexture();
+            reloadedTiles.emplace_back(tile);
+        }
+    }
+
+    m_splitLastFrame = !newTiles.empty() || !checkedTiles.empty() || !reloadedTiles.empty();
+
     // Remove any tiles with all children done rendering
     for (auto it = std::begin(m_tiles); it != std::end(m_tiles); /*Nothing*/)
     {
@@ -59,8 +117,107 @@ void TileSplitter::splitAsNeeded()
         }
     }
 
+    evictOffscreenTiles(m_scheduler.getQueuedCount() + (int)newTiles.size() + (int)reloadedTiles.size());
+
+    for (auto tile : reloadedTiles) {
+        m_scheduler.enqueue(tile);
+    }
     for (auto newTile : newTiles) {
-        m_renderer.render(newTile);
+        m_scheduler.enqueue(newTile);
         m_tiles.emplace_back(newTile);
     }
+    m_tiles.insert(m_tiles.end(), checkedTiles.begin(), checkedTiles.end());
+
+    if (m_reprojection) {
+        m_grid.update(viewBounds, m_camera.getWidthPx(), m_tiles);
+        m_scheduler.prioritize([this](const Tile* tile) {
+            return m_grid.needsRecompute(tile->getBounds());
+        });
+    }
+
+    m_scheduler.update();
+}
+
+void TileSplitter::setReprojection(bool enabled)
+{
+    m_reprojection = enabled;
+    m_grid.reset();
+}
+
+const ReprojectionGrid& TileSplitter::getReprojectionGrid() const
+{
+    return m_grid;
+}
+
+bool TileSplitter::isSharp() const
+{
+    return !m_splitLastFrame && m_scheduler.getQueuedCount() == 0 && m_scheduler.getPendingCount() == 0 &&
+        m_cpuRenderer->getPendingBorderCount() == 0;
+}
+
+int TileSplitter::getRenderedTileCount() const
+{
+    return m_scheduler.getCompletedCount();
+}
+
+unsigned long long TileSplitter::getRenderedBytes() const
+{
+    return m_scheduler.getCompletedBytes();
+}
+
+double TileSplitter::getRenderedIterations() const
+{
+    return m_scheduler.getCompletedIterations();
+}
+
+double TileSplitter::getEstimatedSeconds() const
+{
+    return m_scheduler.getEstimatedSeconds();
+}
+
+void TileSplitter::setRecordCosts(bool enabled)
+{
+    m_scheduler.setRecordCosts(enabled);
+}
+
+void TileSplitter::setAdaptiveIterations(bool enabled)
+{
+    m_adaptiveIterations = enabled;
+}
+
+const std::vector<TileCost::Record>& TileSplitter::getCostRecords() const
+{
+    return m_scheduler.getCostRecords();
+}
+
+void TileSplitter::collectBorderChecks()
+{
+    for (const auto& check : m_cpuRenderer->checkFinishedBorders()) {
+        if (check.interior) {
+            check.tile->setSolid();
+        }
+        else {
+            m_scheduler.enqueue(check.tile);
+        }
+    }
+}
+
+void TileSplitter::evictOffscreenTiles(int layersNeeded)
+{
+    const auto viewBounds = m_camera.getBounds();
+
+    for (auto tile : m_tiles) {
+        if (m_textures.getFreeLayerCount() >= layersNeeded) break;
+
+        // Solid tiles have no layer to free, and are kept: nothing would
+        // recreate them, and they cost no more than their instance slot.
+        // Tiles whose parent is still around would keep it from being
+        // deleted, and it covers them anyway.
+        if (tile->getState() != Tile::State::ACTIVE || tile->isSolid() || tile->getParent() != nullptr)
+            continue;
+
+        if (!inside(tile->getBounds(), viewBounds)) {
+            tile->unloadTexture();
+        }
+    }
 }
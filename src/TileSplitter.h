@@ -1,22 +1,74 @@
 #pragma once
 
+#include "ReprojectionGrid.h"
 #include "Tile.h"
-#include "OpenClRenderer.h"
+#include "TileScheduler.h"
+#include "TileTextureArray.h"
 #include "Camera.h"
 
 #include <vector>
 
+class CpuRenderer;
+
 class TileSplitter
 {
 public:
     TileSplitter(const Camera& camera, Tile::Bounds initialTile);
 
     std::vector<Tile*> getTiles() const;
+    const TileTextureArray& getTextures() const;
 
+    // Splits tiles too coarse for the view. Children which may be inside
+    // the set have their outline checked on the CPU renderer's thread
+    // first, and become solid instead of being queued for rendering if it
+    // is all interior. The parent shows meanwhile.
     void splitAsNeeded();
 
+    // Matches Screen::setReprojection(). While on, queued tiles under parts
+    // of the view which the last frame can't fill in are rendered first.
+    void setReprojection(bool enabled);
+    const ReprojectionGrid& getReprojectionGrid() const;
+
+    // True once nothing in view needs splitting and no tile is waiting on
+    // a renderer, as of the last splitAsNeeded()
+    bool isSharp() const;
+
+    // Tiles rendered so far, and the bytes of texture they filled
+    int getRenderedTileCount() const;
+    unsigned long long getRenderedBytes() const;
+    // Only counts tiles from backends which count iterations
+    double getRenderedIterations() const;
+
+    // See TileScheduler
+    double getEstimatedSeconds() const;
+    void setRecordCosts(bool enabled);
+    const std::vector<TileCost::Record>& getCostRecords() const;
+
+    // Whether split tiles pick their own maxIt, see Tile::split(). On by default.
+    void setAdaptiveIterations(bool enabled);
+
 private:
+    // GPU memory for tile textures at most, which sets how many tiles can be
+    // resident. Less where the device has less, see TileTextureArray.
+    static const long long TEXTURE_BUDGET_BYTES = 1LL << 30;
+
     const Camera& m_camera;
+    TileTextureArray m_textures;
     std::vector<Tile*> m_tiles;
-    OpenClRenderer m_renderer;
-};
\ No newline at end of file
+    TileScheduler m_scheduler;
+    // Owned by the scheduler, also runs the border checks
+    CpuRenderer* m_cpuRenderer;
+    ReprojectionGrid m_grid;
+    bool m_reprojection;
+    bool m_splitLastFrame;
+    bool m_adaptiveIterations;
+
+    // Unloads rendered tiles which are out of view until enough texture
+    // layers are free, or there are no such tiles left. They are queued
+    // again once they come back into view. Solid tiles stay.
+    void evictOffscreenTiles(int layersNeeded);
+
+    // Makes the tiles whose border check came back interior solid, and
+    // queues the others
+    void collectBorderChecks();
+};
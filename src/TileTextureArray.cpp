@@ -0,0 +1,115 @@
+#include "TileTextureArray.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <stdexcept>
+#include <stdio.h>
+
+TileTextureArray::TileTextureArray(int size, int layers) :
+    m_size(size),
+    m_layerCount(layers),
+    m_texture(0)
+{
+    glGenTextures(1, &m_texture);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+
+    // Errors from before aren't ours
+    while (glGetError() != GL_NO_ERROR);
+
+    // No initial data: a layer is only drawn after a renderer has filled it
+    while (true) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, m_size, m_size, m_layerCount, 0, GL_RED, GL_FLOAT, nullptr);
+        if (glGetError() != GL_OUT_OF_MEMORY) break;
+
+        if (m_layerCount / 2 < MIN_LAYERS) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glDeleteTextures(1, &m_texture);
+            throw std::runtime_error("Not enough GPU memory for the tile textures");
+        }
+        m_layerCount /= 2;
+        printf("Out of GPU memory, trying %d tile layers\n", m_layerCount);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Hand out the low layers first
+    for (int layer = m_layerCount - 1; layer >= 0; --layer) {
+        m_freeLayers.push_back(layer);
+    }
+}
+
+TileTextureArray::~TileTextureArray()
+{
+    glDeleteTextures(1, &m_texture);
+}
+
+int TileTextureArray::allocateLayer()
+{
+    if (m_freeLayers.empty()) return -1;
+
+    int layer = m_freeLayers.back();
+    m_freeLayers.pop_back();
+    return layer;
+}
+
+void TileTextureArray::freeLayer(int layer)
+{
+    assert(layer >= 0 && layer < m_layerCount);
+    assert(std::find(m_freeLayers.begin(), m_freeLayers.end(), layer) == m_freeLayers.end());
+
+    m_freeLayers.push_back(layer);
+}
+
+int TileTextureArray::getFreeLayerCount() const
+{
+    return (int)m_freeLayers.size();
+}
+
+int TileTextureArray::getLayerCount() const
+{
+    return m_layerCount;
+}
+
+int TileTextureArray::getSize() const
+{
+    return m_size;
+}
+
+GLuint TileTextureArray::getTexture() const
+{
+    return m_texture;
+}
+
+int TileTextureArray::getLayersForBudget(int size, long long budgetBytes)
+{
+    long long layerBytes = (long long)size * size * sizeof(float);
+
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    // Both report KiB. The rest is left for the framebuffers, and for
+    // anything else running.
+    GLint freeKiB = 0;
+    if (GLEW_NVX_gpu_memory_info) {
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &freeKiB);
+    }
+    else if (GLEW_ATI_meminfo) {
+        // Total free, largest free block, then the same for auxiliary memory
+        GLint info[4] = {};
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+        freeKiB = info[0];
+    }
+    if (freeKiB > 0) {
+        budgetBytes = std::min(budgetBytes, (long long)freeKiB * 1024 / 2);
+    }
+
+    return (int)std::max<long long>(MIN_LAYERS, std::min<long long>(maxLayers, budgetBytes / layerBytes));
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+typedef unsigned int GLuint;
+
+#include <vector>
+
+// Every tile's texture is a layer of one GL_TEXTURE_2D_ARRAY, so the whole
+// tile set can be drawn without binding a texture per tile.
+class TileTextureArray {
+public:
+    // A tile and its four children, the fewest the splitter can work with
+    static const int MIN_LAYERS = 5;
+
+    // The number of layers is fixed, allocating them all up front. Halves
+    // it while GL runs out of memory, and throws below MIN_LAYERS.
+    TileTextureArray(int size, int layers);
+    virtual ~TileTextureArray();
+
+    // Returns -1 if every layer is in use
+    int allocateLayer();
+    void freeLayer(int layer);
+
+    int getFreeLayerCount() const;
+    int getLayerCount() const;
+    int getSize() const;
+
+    GLuint getTexture() const;
+
+    // How many layers of the given size fit in the budget, capped by what
+    // the GL implementation supports, and by half the free video memory
+    // where the driver reports it
+    static int getLayersForBudget(int size, long long budgetBytes);
+
+private:
+    int m_size;
+    int m_layerCount;
+    GLuint m_texture;
+    std::vector<int> m_freeLayers;
+};
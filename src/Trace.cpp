@@ -0,0 +1,163 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <vector>
+
+std::atomic<bool> Trace::s_enabled(false);
+
+namespace {
+
+struct Event {
+    const char* name;
+    long long start;
+    long long end;
+    Trace::Args args;
+};
+
+struct ThreadBuffer {
+    int threadId;
+    std::string name;
+    std::unique_ptr<Event[]> events;
+    // Spans ever recorded, the last CAPACITY of them are in events
+    std::atomic<unsigned long long> written;
+};
+
+// Only taken when a thread records its first span, and to write the trace.
+// Buffers outlive their threads, so finished threads still show up.
+std::mutex s_buffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+
+thread_local ThreadBuffer* t_buffer = nullptr;
+// Set before the thread's first span, so threads which never record cost nothing
+thread_local std::string t_name;
+
+ThreadBuffer* getThreadBuffer()
+{
+    if (t_buffer == nullptr) {
+        std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+        buffer->events.reset(new Event[Trace::CAPACITY]);
+        buffer->written = 0;
+        buffer->name = t_name;
+
+        std::lock_guard<std::mutex> lock(s_buffersMutex);
+        buffer->threadId = (int)s_buffers.size() + 1;
+        t_buffer = buffer.get();
+        s_buffers.push_back(std::move(buffer));
+    }
+    return t_buffer;
+}
+
+void writeJsonString(FILE* file, const std::string& text)
+{
+    fputc('"', file);
+    for (char c : text) {
+        if (c == '"' || c == '\\') fputc('\\', file);
+        if ((unsigned char)c >= 0x20) fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+}
+
+void Trace::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+long long Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::addSpan(const char* name, long long start, long long end, const Args& args)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+
+    // Only this thread writes, the release pairs with writeChromeJson's acquire
+    unsigned long long index = buffer->written.load(std::memory_order_relaxed);
+    buffer->events[index % CAPACITY] = { name, start, end, args };
+    buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void Trace::setThreadName(const std::string& name)
+{
+    t_name = name;
+
+    if (t_buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(s_buffersMutex);
+        t_buffer->name = name;
+    }
+}
+
+void Trace::writeChromeJson(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    std::lock_guard<std::mutex> lock(s_buffersMutex);
+
+    // Timestamps start at the first span
+    long long origin = 0;
+    bool first = true;
+    for (const auto& buffer : s_buffers) {
+        unsigned long long written = buffer->written.load(std::memory_order_acquire);
+        unsigned long long oldest = written > CAPACITY ? written - CAPACITY : 0;
+        for (unsigned long long i = oldest; i < written; ++i) {
+            long long start = buffer->events[i % CAPACITY].start;
+            if (first || start < origin) origin = start;
+            first = false;
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    const char* separator = "";
+    for (const auto& buffer : s_buffers) {
+        if (!buffer->name.empty()) {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", separator, buffer->threadId);
+            writeJsonString(file, buffer->name);
+            fprintf(file, "}}");
+            separator = ",\n";
+        }
+
+        unsigned long long written = buffer->written.load(std::memory_order_acquire);
+        unsigned long long oldest = written > CAPACITY ? written - CAPACITY : 0;
+
+        for (unsigned long long i = oldest; i < written; ++i) {
+            const Event& event = buffer->events[i % CAPACITY];
+
+            // Chrome wants microseconds
+            fprintf(file, "%s{\"name\": ", separator);
+            writeJsonString(file, event.name);
+            fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                buffer->threadId, (event.start - origin) * 1e-3, (event.end - event.start) * 1e-3);
+
+            const char* argSeparator = "";
+            if (event.args.tile >= 0) {
+                fprintf(file, "\"tile\": %lld", event.args.tile);
+                argSeparator = ", ";
+            }
+            if (event.args.generation >= 0) {
+                fprintf(file, "%s\"generation\": %d", argSeparator, event.args.generation);
+                argSeparator = ", ";
+            }
+            if (event.args.iterations >= 0.0) {
+                fprintf(file, "%s\"iterations\": %.0f", argSeparator, event.args.iterations);
+            }
+            fprintf(file, "}}");
+            separator = ",\n";
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
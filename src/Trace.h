@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Timed spans for seeing where frames and tiles spend their time, dumped
+// in the Chrome trace format which chrome://tracing and Perfetto open.
+//
+// Each thread records into its own ring buffer, so recording takes no lock
+// and the newest spans are kept when a buffer wraps. While tracing is off a
+// span costs one relaxed atomic load.
+class Trace {
+public:
+    // Attached to a span, -1 where it doesn't apply
+    struct Args {
+        long long tile;
+        int generation;
+        double iterations;
+    };
+
+    // Spans kept per thread
+    static const size_t CAPACITY = 1 << 16;
+
+    static void setEnabled(bool enabled);
+
+    static bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Nanoseconds on the steady clock
+    static long long now();
+
+    // Records a span which has already ended. The name must stay valid until
+    // the trace is written, in practice a string literal.
+    static void addSpan(const char* name, long long start, long long end, const Args& args);
+
+    // Names the calling thread in the trace
+    static void setThreadName(const std::string& name);
+
+    // Writes every thread's spans. Spans recorded while this runs may be
+    // torn, so write once the work being traced is done.
+    static void writeChromeJson(const std::string& path);
+
+    // Times its own lifetime
+    class Span {
+    public:
+        explicit Span(const char* name, long long tile = -1, int generation = -1) :
+            m_name(isEnabled() ? name : nullptr),
+            m_start(m_name != nullptr ? now() : 0),
+            m_args{ tile, generation, -1.0 }
+        {
+        }
+
+        ~Span()
+        {
+            if (m_name != nullptr) {
+                addSpan(m_name, m_start, now(), m_args);
+            }
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        void setIterations(double iterations)
+        {
+            m_args.iterations = iterations;
+        }
+
+    private:
+        const char* m_name;
+        long long m_start;
+        Args m_args;
+    };
+
+private:
+    static std::atomic<bool> s_enabled;
+};
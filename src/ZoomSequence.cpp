@@ -0,0 +1,193 @@
+#include "ZoomSequence.h"
+
+#include "StreamingExporter.h"
+#include "Tile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <stdio.h>
+
+// Rows read and colorized at a time when loading a level
+static const int LOAD_BAND_ROWS = 256;
+
+void ZoomSequence::render(const std::string& directory, const Settings& settings, int bandRows)
+{
+    {
+        std::ofstream file(getSettingsPath(directory));
+        // centerX centerY width levels widthPx heightPx maxIt
+        file << std::setprecision(17)
+            << settings.centerX << ' ' << settings.centerY << ' ' << settings.width << ' '
+            << settings.levels << ' ' << settings.widthPx << ' ' << settings.heightPx << ' '
+            << settings.maxIt << '\n';
+        if (!file) {
+            throw std::runtime_error("Failed to write " + getSettingsPath(directory));
+        }
+    }
+
+    for (int level = 0; level < settings.levels; ++level) {
+        double width = std::ldexp(settings.width, -level);
+        double height = width * settings.heightPx / settings.widthPx;
+
+        Tile::Bounds bounds{
+            (float)(settings.centerX - width / 2),
+            (float)(settings.centerX + width / 2),
+            (float)(settings.centerY - height / 2),
+            (float)(settings.centerY + height / 2),
+            (float)settings.maxIt
+        };
+
+        StreamingExporter exporter(bounds, settings.widthPx, settings.heightPx, bandRows);
+        exporter.exportRaw(getLevelPath(directory, level));
+
+        printf("Level %d of %d done\n", level + 1, settings.levels);
+    }
+}
+
+ZoomSequence::ZoomSequence(const std::string& directory, const Colorizer& colorizer) :
+    m_directory(directory),
+    m_colorizer(colorizer)
+{
+    std::ifstream file(getSettingsPath(directory));
+    Settings& s = m_settings;
+    if (!(file >> s.centerX >> s.centerY >> s.width >> s.levels >> s.widthPx >> s.heightPx >> s.maxIt) ||
+        s.levels <= 0 || s.widthPx <= 0 || s.heightPx <= 0) {
+        throw std::runtime_error("Failed to read " + getSettingsPath(directory));
+    }
+}
+
+const ZoomSequence::Settings& ZoomSequence::getSettings() const
+{
+    return m_settings;
+}
+
+void ZoomSequence::composite(double zoom, int widthPx, int heightPx, unsigned char* rgb)
+{
+    zoom = std::min(std::max(zoom, 0.0), (double)(m_settings.levels - 1));
+
+    const int coarse = std::min((int)zoom, m_settings.levels - 1);
+    const int fine = std::min(coarse + 1, m_settings.levels - 1);
+
+    const int levelWidth = m_settings.widthPx;
+    const int levelHeight = m_settings.heightPx;
+
+    // Both are needed at once, fetch them before either can be evicted
+    const unsigned char* levelImages[2] = { getLevel(coarse), getLevel(fine) };
+    const int levelIndices[2] = { coarse, fine };
+
+    double pixelSize = m_settings.width / std::pow(2.0, zoom) / widthPx;
+    double left = m_settings.centerX - pixelSize * widthPx / 2;
+    double top = m_settings.centerY - pixelSize * heightPx / 2;
+
+    // Position of every output column and row in each level's pixels, where
+    // pixel i of a level sits at its left edge + i * its pixel size, as in
+    // CpuKernel
+    std::vector<float> columns[2];
+    std::vector<float> rows[2];
+    for (int i = 0; i < 2; ++i) {
+        double levelPixel = std::ldexp(m_settings.width, -levelIndices[i]) / levelWidth;
+        double levelLeft = m_settings.centerX - levelPixel * levelWidth / 2;
+        double levelTop = m_settings.centerY - levelPixel * levelHeight / 2;
+
+        columns[i].resize(widthPx);
+        for (int x = 0; x < widthPx; ++x) {
+            columns[i][x] = (float)((left + x * pixelSize - levelLeft) / levelPixel);
+        }
+        rows[i].resize(heightPx);
+        for (int y = 0; y < heightPx; ++y) {
+            rows[i][y] = (float)((top + y * pixelSize - levelTop) / levelPixel);
+        }
+    }
+
+    auto insideLevel = [&](float u, float v) {
+        return u >= 0.f && v >= 0.f && u <= levelWidth - 1 && v <= levelHeight - 1;
+    };
+
+    for (int y = 0; y < heightPx; ++y) {
+        unsigned char* out = rgb + (size_t)y * widthPx * 3;
+
+        for (int x = 0; x < widthPx; ++x) {
+            // The finer level wherever it reaches, the coarser one around it
+            int i = insideLevel(columns[1][x], rows[1][y]) ? 1 : 0;
+
+            float u = std::min(std::max(columns[i][x], 0.f), (float)(levelWidth - 1));
+            float v = std::min(std::max(rows[i][y], 0.f), (float)(levelHeight - 1));
+
+            int x0 = std::min((int)u, std::max(levelWidth - 2, 0));
+            int y0 = std::min((int)v, std::max(levelHeight - 2, 0));
+            int x1 = std::min(x0 + 1, levelWidth - 1);
+            int y1 = std::min(y0 + 1, levelHeight - 1);
+
+            // Bilinear, with 8-bit weights
+            int wx = (int)((u - x0) * 256.f + 0.5f);
+            int wy = (int)((v - y0) * 256.f + 0.5f);
+
+            const unsigned char* image = levelImages[i];
+            const unsigned char* p00 = image + ((size_t)y0 * levelWidth + x0) * 3;
+            const unsigned char* p01 = image + ((size_t)y0 * levelWidth + x1) * 3;
+            const unsigned char* p10 = image + ((size_t)y1 * levelWidth + x0) * 3;
+            const unsigned char* p11 = image + ((size_t)y1 * levelWidth + x1) * 3;
+
+            for (int channel = 0; channel < 3; ++channel) {
+                int upper = p00[channel] * (256 - wx) + p01[channel] * wx;
+                int lower = p10[channel] * (256 - wx) + p11[channel] * wx;
+                out[x * 3 + channel] = (unsigned char)((upper * (256 - wy) + lower * wy + (1 << 15)) >> 16);
+            }
+        }
+    }
+}
+
+const unsigned char* ZoomSequence::getLevel(int level)
+{
+    m_recentLevels.erase(std::remove(m_recentLevels.begin(), m_recentLevels.end(), level), m_recentLevels.end());
+    m_recentLevels.push_back(level);
+
+    auto found = m_levels.find(level);
+    if (found != m_levels.end()) {
+        return found->second.data();
+    }
+
+    while (m_recentLevels.size() > 2) {
+        m_levels.erase(m_recentLevels.front());
+        m_recentLevels.erase(m_recentLevels.begin());
+    }
+
+    const std::string path = getLevelPath(m_directory, level);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    const size_t rowPixels = (size_t)m_settings.widthPx;
+    std::vector<unsigned char>& rgb = m_levels[level];
+    rgb.resize(rowPixels * m_settings.heightPx * 3);
+
+    // Colorized band by band, so the floats never all sit in memory
+    std::vector<float> depth(rowPixels * LOAD_BAND_ROWS);
+    for (int row = 0; row < m_settings.heightPx; row += LOAD_BAND_ROWS) {
+        size_t count = rowPixels * std::min(LOAD_BAND_ROWS, m_settings.heightPx - row);
+        if (fread(depth.data(), sizeof(float), count, file) != count) {
+            fclose(file);
+            m_levels.erase(level);
+            throw std::runtime_error("Truncated level " + path);
+        }
+        m_colorizer.colorize(depth.data(), count, rgb.data() + row * rowPixels * 3);
+    }
+
+    fclose(file);
+    return rgb.data();
+}
+
+std::string ZoomSequence::getLevelPath(const std::string& directory, int level)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/level%04d.raw", level);
+    return directory + name;
+}
+
+std::string ZoomSequence::getSettingsPath(const std::string& directory)
+{
+    return directory + "/zoom.txt";
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Colorizer.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// A deep zoom stored as one image per factor of two, all about the same
+// center. Any zoom in between is composited from the two levels around it,
+// so a zoom video takes O(log zoom) renders instead of one per frame.
+// Levels are kept as raw iteration counts, so they can be recolored freely.
+class ZoomSequence {
+public:
+    struct Settings {
+        double centerX;
+        double centerY;
+        // Width of level 0 in the complex plane, each level halves it
+        double width;
+        int levels;
+        int widthPx;
+        int heightPx;
+        int maxIt;
+    };
+
+    // Renders every level into directory, which must exist, along with the
+    // settings needed to read them back
+    static void render(const std::string& directory, const Settings& settings, int bandRows);
+
+    // Opens a rendered sequence, throws std::runtime_error if it can't
+    ZoomSequence(const std::string& directory, const Colorizer& colorizer);
+
+    const Settings& getSettings() const;
+
+    // Fills rgb (widthPx * heightPx * 3) with the view at zoom, where 0 is
+    // level 0 and every +1 halves the width. Fractions use the two levels
+    // around them, the finer one wherever it reaches.
+    void composite(double zoom, int widthPx, int heightPx, unsigned char* rgb);
+
+private:
+    std::string m_directory;
+    Settings m_settings;
+    Colorizer m_colorizer;
+
+    // Colorized levels, only the two last used are kept
+    std::map<int, std::vector<unsigned char>> m_levels;
+    std::vector<int> m_recentLevels;
+
+    const unsigned char* getLevel(int level);
+
+    static std::string getLevelPath(const std::string& directory, int level);
+    static std::string getSettingsPath(const std::string& directory);
+};
@@ -0,0 +1,276 @@
+// Compares every kernel on the reference views: the CPU kernel variants,
+// and the OpenCL ones when there is a device.
+// cardioid-interior is the interior-heavy view and seahorse-valley the
+// boundary-heavy one, where work per pixel varies the most.
+// Runs without a window, so it also works on CPU runtimes such as POCL.
+//
+// Usage: MandelbrotBenchmark [--json results.json] [size] [repetitions]
+//        MandelbrotBenchmark autotune [size] [repetitions]
+//
+// Every OpenCL configuration's statistics, reduced on the device, are also
+// checked against the same ones measured on the host from its output. Any
+// difference is reported, and fails the run.
+//
+// --json also writes every measurement to a file, for tracking results
+// across releases. autotune sweeps every OpenCL kernel configuration and
+// saves the fastest to opencl-tuning.txt, where the game picks it up at
+// startup.
+
+// Include standard headers
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "CpuKernel.h"
+#include "OpenClAutotuner.h"
+#include "OpenClRenderer.h"
+#include "ReferenceViews.h"
+#include "TileCost.h"
+
+struct Configuration {
+    OpenClRenderer::KernelVariant variant;
+    int vectorWidth;
+};
+
+struct Measurement {
+    std::string view;
+    std::string backend;
+    std::string kernel;
+    int vectorWidth;
+    double seconds;
+    double iterations;
+};
+
+// Best of several runs, in seconds. render() returns the time of one run.
+static double timeBest(int repetitions, const std::function<double()>& render)
+{
+    // Warm up, so the first configuration isn't charged for the setup
+    render();
+
+    double best = 0.0;
+    for (int i = 0; i < repetitions; ++i) {
+        double seconds = render();
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+// True if the kernel's statistics are what the host measures from its output
+static bool statisticsMatch(const TileCost& device, const TileCost& host)
+{
+    bool outside = host.getInteriorCount() < host.getPixelCount();
+
+    return device.getPixelCount() == host.getPixelCount() &&
+        device.getTotalIterations() == host.getTotalIterations() &&
+        device.getInteriorCount() == host.getInteriorCount() &&
+        device.getHistogram() == host.getHistogram() &&
+        device.getMap() == host.getMap() &&
+        (!outside || (device.getMinValue() == host.getMinValue() && device.getMaxValue() == host.getMaxValue()));
+}
+
+static std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if ((unsigned char)c >= 0x20) quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static void writeJson(const std::string& path, const std::string& device, int size, int repetitions, const std::vector<Measurement>& measurements)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": %s,\n", jsonString(device).c_str());
+    fprintf(file, "  \"size\": %d,\n", size);
+    fprintf(file, "  \"repetitions\": %d,\n", repetitions);
+    fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < measurements.size(); ++i) {
+        const auto& measurement = measurements[i];
+        fprintf(file, "    { \"view\": %s, \"backend\": %s, \"kernel\": %s, \"vectorWidth\": %d, "
+            "\"seconds\": %.6g, \"pixelsPerSecond\": %.6g, \"iterationsPerSecond\": %.6g }%s\n",
+            jsonString(measurement.view).c_str(),
+            jsonString(measurement.backend).c_str(),
+            jsonString(measurement.kernel).c_str(),
+            measurement.vectorWidth,
+            measurement.seconds,
+            (double)size * size / measurement.seconds,
+            measurement.iterations / measurement.seconds,
+            i + 1 < measurements.size() ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    if (fclose(file) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+static int autotune(OpenClRenderer& renderer, int size, int repetitions)
+{
+    printf("Device: %s\n", renderer.getDeviceKey().c_str());
+    printf("Tile size: %d x %d, median of %d, summed over the reference views\n\n", size, size, repetitions);
+
+    OpenClAutotuner autotuner(renderer, size, repetitions);
+    auto results = autotuner.run();
+
+    OpenClAutotuner::printTable(results);
+
+    if (results.empty() || !results[0].valid) {
+        fprintf(stderr, "No configuration worked\n");
+        return 1;
+    }
+
+    OpenClAutotuner::save(OpenClAutotuner::DEFAULT_PATH, renderer.getDeviceKey(), results[0].config);
+    printf("\nSaved the fastest configuration to %s\n", OpenClAutotuner::DEFAULT_PATH);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bool tuning = argc > 1 && std::string(argv[1]) == "autotune";
+    if (tuning) {
+        --argc;
+        ++argv;
+    }
+
+    std::string jsonPath;
+    if (argc > 2 && std::string(argv[1]) == "--json") {
+        jsonPath = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    int size = argc > 1 ? atoi(argv[1]) : 1024;
+    int repetitions = argc > 2 ? atoi(argv[2]) : 3;
+
+    std::unique_ptr<OpenClRenderer> renderer;
+    try {
+        renderer.reset(new OpenClRenderer(false));
+    }
+    catch (const std::exception& e) {
+        if (tuning) throw;
+        printf("OpenCL unavailable: %s\n", e.what());
+    }
+
+    if (tuning) {
+        return autotune(*renderer, size, repetitions);
+    }
+
+    std::vector<Configuration> configurations;
+    std::string device = "CPU only";
+
+    if (renderer) {
+        int preferredWidth = renderer->getVectorWidth();
+        device = renderer->getName();
+
+        printf("Device: %s\n", device.c_str());
+        printf("Preferred vector width: %d\n", preferredWidth);
+
+        configurations = {
+            { OpenClRenderer::KernelVariant::SCALAR, 1 },
+            { OpenClRenderer::KernelVariant::VECTOR, 4 },
+            { OpenClRenderer::KernelVariant::VECTOR, 8 },
+            { OpenClRenderer::KernelVariant::PERSISTENT, 1 },
+        };
+        if (preferredWidth != 1 && preferredWidth != 4 && preferredWidth != 8) {
+            configurations.push_back({ OpenClRenderer::KernelVariant::VECTOR, preferredWidth });
+        }
+    }
+
+    std::vector<CpuKernel::Variant> cpuVariants;
+    for (auto variant : { CpuKernel::Variant::SCALAR, CpuKernel::Variant::SSE2 }) {
+        if (CpuKernel::isSupported(variant)) {
+            cpuVariants.push_back(variant);
+        }
+    }
+
+    printf("Tile size: %d x %d, best of %d, speedup against the scalar CPU kernel\n\n", size, size, repetitions);
+
+    std::vector<float> output((size_t)size * size);
+    std::vector<Measurement> measurements;
+    int mismatches = 0;
+
+    printf("%-20s %-7s %-10s %5s %10s %10s %10s %8s\n", "view", "backend", "kernel", "width", "ms", "Mpx/s", "Git/s", "speedup");
+
+    auto report = [&](const Measurement& measurement, double baselineSeconds) {
+        printf("%-20s %-7s %-10s %5d %10.2f %10.1f %10.2f %7.2fx\n",
+            measurement.view.c_str(),
+            measurement.backend.c_str(),
+            measurement.kernel.c_str(),
+            measurement.vectorWidth,
+            measurement.seconds * 1e3,
+            (double)size * size / measurement.seconds / 1e6,
+            measurement.iterations / measurement.seconds / 1e9,
+            baselineSeconds / measurement.seconds
+        );
+        measurements.push_back(measurement);
+    };
+
+    for (const auto& view : getReferenceViews()) {
+        // Every kernel runs the same iterations, count them once on the reference
+        CpuKernel::render(view.bounds, size, size, output.data(), CpuKernel::Variant::SCALAR);
+        double iterations = CpuKernel::countIterations(output.data(), output.size(), view.bounds.maxIt);
+
+        double scalarSeconds = 0.0;
+
+        for (auto variant : cpuVariants) {
+            double seconds = timeBest(repetitions, [&]() {
+                auto start = std::chrono::steady_clock::now();
+                CpuKernel::render(view.bounds, size, size, output.data(), variant);
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            });
+            if (variant == CpuKernel::Variant::SCALAR) {
+                scalarSeconds = seconds;
+            }
+
+            report({ view.name, "cpu", CpuKernel::getVariantName(variant), variant == CpuKernel::Variant::SSE2 ? 4 : 1, seconds, iterations }, scalarSeconds);
+        }
+
+        for (const auto& configuration : configurations) {
+            renderer->setVectorWidth(configuration.vectorWidth);
+            renderer->setKernelVariant(configuration.variant);
+
+            TileCost deviceCost(size, size, view.bounds.maxIt);
+            renderer->renderToHost(view.bounds, size, output.data(), &deviceCost);
+            TileCost hostCost(size, size, view.bounds.maxIt);
+            hostCost.addRows(output.data(), 0, size);
+            if (!statisticsMatch(deviceCost, hostCost)) {
+                fprintf(stderr, "%s, %s width %d: the kernel's statistics don't match its output\n",
+                    view.name, OpenClRenderer::getVariantName(configuration.variant), renderer->getVectorWidth());
+                ++mismatches;
+            }
+
+            double seconds = timeBest(repetitions, [&]() {
+                return renderer->renderToHost(view.bounds, size, output.data());
+            });
+
+            int vectorWidth = configuration.variant == OpenClRenderer::KernelVariant::VECTOR ? renderer->getVectorWidth() : 1;
+            report({ view.name, "opencl", OpenClRenderer::getVariantName(configuration.variant), vectorWidth, seconds, iterations }, scalarSeconds);
+        }
+    }
+
+    if (!jsonPath.empty()) {
+        writeJson(jsonPath, device, size, repetitions, measurements);
+        printf("\nWrote %zu results to %s\n", measurements.size(), jsonPath.c_str());
+    }
+
+    if (mismatches > 0) {
+        fprintf(stderr, "\n%d configurations measured statistics wrong\n", mismatches);
+        return 1;
+    }
+
+    return 0;
+}
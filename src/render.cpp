@@ -0,0 +1,427 @@
+// Renders a single view on the CPU and writes it to disk. Needs neither a
+// display nor a GPU, colors match what the game shows.
+// The image is rendered and written in bands of rows, so memory stays at a
+// few bands whatever the resolution, 100k x 100k included.
+//
+// Usage: mandelbrot-render [options] output.png|output.ppm|output.raw
+//
+//   --center X Y       center of the view (default -0.5 0)
+//   --width W          width of the view in the complex plane (default 4)
+//   --iterations N     iteration limit (default 1000)
+//   --size WxH         resolution in pixels (default 1920x1080)
+//   --palette NAME     rainbow, grayscale or fire (default rainbow)
+//   --period P         iterations per palette cycle (default 32, as in the game)
+//   --cutoff C         values above this are drawn black (default iterations - 1)
+//   --band-rows N      rows rendered and written at a time (default 64)
+//   --cost-map         draw what each pixel cost instead, see below
+//   --aa N             supersample edges, up to N samples per pixel (default 1, off)
+//   --aa-budget B      extra samples per pixel on average at most (default 1)
+//
+// --aa only spends samples where neighboring pixels' colors differ
+// strongly, adding them in rounds until each pixel's color settles, so it
+// costs a fraction of supersampling the whole image.
+//
+// --cost-map writes a heatmap of the iterations per pixel, black for one
+// through red and yellow to white at the limit on a log scale, and prints
+// a histogram of them.
+//
+// .raw writes the smoothed iteration counts instead of colors: 32-bit
+// floats in native byte order, row by row from the top.
+//
+//        mandelbrot-render --animate keyframes.txt [options] frame%05d.png|video.rgb|-
+//
+// Renders a zoom animation along the keyframes, see AnimationRenderer for
+// the file format. A printf-style output pattern writes numbered PNG or PPM
+// images, anything else a raw rgb24 stream, where - is stdout:
+//   mandelbrot-render --animate zoom.txt - | ffmpeg -f rawvideo -pix_fmt rgb24 -s 1920x1080 -r 60 -i - zoom.mp4
+// --center, --width and --cutoff come from the keyframes instead.
+//
+//        mandelbrot-render --zoom-out LEVELS [options] directory
+//        mandelbrot-render --zoom-video directory [--frames-per-level F] [options] frame%05d.png|video.rgb|-
+//
+// The fast way to long deep zooms: --zoom-out renders LEVELS images about
+// --center into an existing directory, the first --width wide and each next
+// one half as wide. --zoom-video then composites F frames per level (default
+// 60) from those, with --size setting the video's resolution. Rendering the
+// levels at a higher resolution than the video keeps it sharp.
+
+// Include standard headers
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "AnimationRenderer.h"
+#include "Colorizer.h"
+#include "ImageWriter.h"
+#include "Palette.h"
+#include "StreamingExporter.h"
+#include "TileCost.h"
+#include "Tile.h"
+#include "ZoomSequence.h"
+
+struct Options {
+    double centerX = -0.5;
+    double centerY = 0.0;
+    double width = 4.0;
+    int iterations = 1000;
+    int widthPx = 1920;
+    int heightPx = 1080;
+    std::string palette = "rainbow";
+    float colorPeriod = 32.f;
+    float cutoff = -1.f;
+    int bandRows = 64;
+    bool costMap = false;
+    int aaSamples = 1;
+    double aaBudget = 1.0;
+    std::string keyframes;
+    int zoomLevels = 0;
+    std::string zoomVideo;
+    int framesPerLevel = 60;
+    std::string output;
+};
+
+static void printUsage()
+{
+    fprintf(stderr,
+        "Usage: mandelbrot-render [options] output.png|output.ppm|output.raw\n"
+        "  --center X Y       center of the view (default -0.5 0)\n"
+        "  --width W          width of the view in the complex plane (default 4)\n"
+        "  --iterations N     iteration limit (default 1000)\n"
+        "  --size WxH         resolution in pixels (default 1920x1080)\n"
+        "  --palette NAME     rainbow, grayscale or fire (default rainbow)\n"
+        "  --period P         iterations per palette cycle (default 32)\n"
+        "  --cutoff C         values above this are drawn black (default iterations - 1)\n"
+        "  --band-rows N      rows rendered and written at a time (default 64)\n"
+        "  --cost-map         draw a heatmap of the iterations per pixel instead\n"
+        "  --aa N             supersample edges, up to N samples per pixel (default 1, off)\n"
+        "  --aa-budget B      extra samples per pixel on average at most (default 1)\n"
+        "\n"
+        "       mandelbrot-render --animate keyframes.txt [options] frame%%05d.png|video.rgb|-\n"
+        "       mandelbrot-render --zoom-out LEVELS [options] directory\n"
+        "       mandelbrot-render --zoom-video directory [--frames-per-level F] [options] frame%%05d.png|video.rgb|-\n");
+}
+
+// Returns false if the arguments don't make sense
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        int remaining = argc - i - 1;
+
+        if (arg == "--center" && remaining >= 2) {
+            options.centerX = atof(argv[++i]);
+            options.centerY = atof(argv[++i]);
+        }
+        else if (arg == "--width" && remaining >= 1) {
+            options.width = atof(argv[++i]);
+        }
+        else if (arg == "--iterations" && remaining >= 1) {
+            options.iterations = atoi(argv[++i]);
+        }
+        else if (arg == "--size" && remaining >= 1) {
+            if (sscanf(argv[++i], "%dx%d", &options.widthPx, &options.heightPx) != 2) return false;
+        }
+        else if (arg == "--palette" && remaining >= 1) {
+            options.palette = argv[++i];
+        }
+        else if (arg == "--period" && remaining >= 1) {
+            options.colorPeriod = (float)atof(argv[++i]);
+        }
+        else if (arg == "--cutoff" && remaining >= 1) {
+            options.cutoff = (float)atof(argv[++i]);
+        }
+        else if (arg == "--band-rows" && remaining >= 1) {
+            options.bandRows = atoi(argv[++i]);
+        }
+        else if (arg == "--cost-map") {
+            options.costMap = true;
+        }
+        else if (arg == "--aa" && remaining >= 1) {
+            options.aaSamples = atoi(argv[++i]);
+        }
+        else if (arg == "--aa-budget" && remaining >= 1) {
+            options.aaBudget = atof(argv[++i]);
+        }
+        else if (arg == "--animate" && remaining >= 1) {
+            options.keyframes = argv[++i];
+        }
+        else if (arg == "--zoom-out" && remaining >= 1) {
+            options.zoomLevels = atoi(argv[++i]);
+        }
+        else if (arg == "--zoom-video" && remaining >= 1) {
+            options.zoomVideo = argv[++i];
+        }
+        else if (arg == "--frames-per-level" && remaining >= 1) {
+            options.framesPerLevel = atoi(argv[++i]);
+        }
+        else if (arg == "-" && options.output.empty()) {
+            options.output = arg;
+        }
+        else if (arg.compare(0, 2, "--") != 0 && options.output.empty()) {
+            options.output = arg;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (options.cutoff < 0.f) {
+        // Interior points keep the iteration limit, escaping ones stay well below it
+        options.cutoff = options.iterations - 1.f;
+    }
+
+    return !options.output.empty() &&
+        options.width > 0.0 &&
+        options.iterations > 0 &&
+        options.widthPx > 0 && options.heightPx > 0 &&
+        options.bandRows > 0 &&
+        options.zoomLevels >= 0 &&
+        options.framesPerLevel > 0 &&
+        options.aaSamples >= 1 &&
+        options.aaBudget >= 0.0 &&
+        options.colorPeriod > 0.f;
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Where animation frames go: numbered images for a printf-style pattern,
+// otherwise one raw rgb24 stream, - being stdout
+class FrameOutput {
+public:
+    FrameOutput(const std::string& output, int widthPx, int heightPx) :
+        m_output(output),
+        m_widthPx(widthPx),
+        m_heightPx(heightPx),
+        m_numbered(output.find('%') != std::string::npos),
+        m_stream(nullptr)
+    {
+        if (output == "-") {
+            m_stream = stdout;
+        }
+        else if (!m_numbered) {
+            m_stream = fopen(output.c_str(), "wb");
+            if (m_stream == nullptr) {
+                throw std::runtime_error("Failed to open " + output);
+            }
+        }
+    }
+
+    ~FrameOutput()
+    {
+        if (m_stream != nullptr && m_stream != stdout) {
+            fclose(m_stream);
+        }
+    }
+
+    void write(int frame, const unsigned char* rgb)
+    {
+        if (m_numbered) {
+            char path[4096];
+            snprintf(path, sizeof(path), m_output.c_str(), frame);
+            ImageWriter::write(path, m_widthPx, m_heightPx, rgb);
+            return;
+        }
+
+        size_t size = (size_t)m_widthPx * m_heightPx * 3;
+        if (fwrite(rgb, 1, size, m_stream) != size) {
+            throw std::runtime_error("Failed to write frame " + std::to_string(frame));
+        }
+    }
+
+    void close()
+    {
+        FILE* stream = m_stream;
+        m_stream = nullptr;
+
+        bool failed = stream == stdout ? fflush(stream) != 0 : (stream != nullptr && fclose(stream) != 0);
+        if (failed) {
+            throw std::runtime_error("Failed to write " + m_output);
+        }
+    }
+
+private:
+    std::string m_output;
+    int m_widthPx;
+    int m_heightPx;
+    bool m_numbered;
+    FILE* m_stream;
+};
+
+static void renderAnimation(const Options& options)
+{
+    AnimationRenderer renderer(AnimationRenderer::loadKeyframes(options.keyframes), options.widthPx, options.heightPx, options.iterations);
+    Colorizer colorizer(Palette::fromName(options.palette), options.colorPeriod, options.cutoff);
+    FrameOutput output(options.output, options.widthPx, options.heightPx);
+
+    // stdout may be carrying the video
+    fprintf(stderr, "Rendering %d frames of %d x %d\n", renderer.getFrameCount(), options.widthPx, options.heightPx);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<unsigned char> rgb((size_t)options.widthPx * options.heightPx * 3);
+    size_t pixelCount = (size_t)options.widthPx * options.heightPx;
+
+    renderer.run([&](int frame, const float* depth, const AnimationRenderer::View& view) {
+        colorizer.setCutoff(view.cutoff);
+        colorizer.colorize(depth, pixelCount, rgb.data());
+        output.write(frame, rgb.data());
+    });
+
+    output.close();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto statistics = renderer.getStatistics();
+
+    fprintf(stderr, "Rendered %d frames in %.2f s: %d tiles rendered for %lld shown, at most %d cached\n",
+        renderer.getFrameCount(), seconds,
+        statistics.tilesRendered, statistics.tilesShown, statistics.peakCachedTiles);
+}
+
+static void renderZoomLevels(const Options& options)
+{
+    ZoomSequence::Settings settings{
+        options.centerX,
+        options.centerY,
+        options.width,
+        options.zoomLevels,
+        options.widthPx,
+        options.heightPx,
+        options.iterations
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    ZoomSequence::render(options.output, settings, options.bandRows);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Rendered %d levels into %s in %.2f s\n", options.zoomLevels, options.output.c_str(), seconds);
+}
+
+static void compositeZoomVideo(const Options& options)
+{
+    Colorizer colorizer(Palette::fromName(options.palette), options.colorPeriod, options.cutoff);
+    ZoomSequence sequence(options.zoomVideo, colorizer);
+    FrameOutput output(options.output, options.widthPx, options.heightPx);
+
+    int frameCount = (sequence.getSettings().levels - 1) * options.framesPerLevel + 1;
+    fprintf(stderr, "Compositing %d frames of %d x %d\n", frameCount, options.widthPx, options.heightPx);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<unsigned char> rgb((size_t)options.widthPx * options.heightPx * 3);
+    for (int frame = 0; frame < frameCount; ++frame) {
+        sequence.composite((double)frame / options.framesPerLevel, options.widthPx, options.heightPx, rgb.data());
+        output.write(frame, rgb.data());
+    }
+
+    output.close();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Composited %d frames in %.2f s\n", frameCount, seconds);
+}
+
+static void printCostHistogram(const TileCost& cost)
+{
+    const auto& histogram = cost.getHistogram();
+    double pixels = 0.0;
+    for (double count : histogram) {
+        pixels += count;
+    }
+
+    printf("%.0f iterations, %.1f per pixel\n", cost.getTotalIterations(), cost.getTotalIterations() / pixels);
+    printf("Iterations per pixel       pixels\n");
+
+    for (int bin = 0; bin < TileCost::HISTOGRAM_BINS; ++bin) {
+        if (histogram[bin] == 0.0) continue;
+
+        // The first bin also holds the pixels which took a single iteration
+        double low = bin == 0 ? 1.0 : (double)(1 << bin);
+        double high = (double)(2 << bin) - 1;
+        if (bin + 1 < TileCost::HISTOGRAM_BINS) {
+            printf("%9.0f - %-9.0f %12.0f  %5.1f%%\n", low, high, histogram[bin], histogram[bin] / pixels * 100);
+        }
+        else {
+            printf("%9.0f and up    %12.0f  %5.1f%%\n", low, histogram[bin], histogram[bin] / pixels * 100);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    try {
+        if (!options.keyframes.empty()) {
+            renderAnimation(options);
+            return 0;
+        }
+        if (options.zoomLevels > 0) {
+            renderZoomLevels(options);
+            return 0;
+        }
+        if (!options.zoomVideo.empty()) {
+            compositeZoomVideo(options);
+            return 0;
+        }
+
+        // Square pixels, so the height in the plane follows from the resolution
+        double height = options.width * options.heightPx / options.widthPx;
+
+        Tile::Bounds bounds{
+            (float)(options.centerX - options.width / 2),
+            (float)(options.centerX + options.width / 2),
+            (float)(options.centerY - height / 2),
+            (float)(options.centerY + height / 2),
+            (float)options.iterations
+        };
+
+        StreamingExporter exporter(bounds, options.widthPx, options.heightPx, options.bandRows);
+        bool raw = endsWith(options.output, ".raw");
+
+        printf("Rendering %d x %d in bands of %d rows, using %.1f MiB\n",
+            options.widthPx, options.heightPx, options.bandRows, exporter.getPeakBytes(!raw) / (1024.0 * 1024.0));
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (options.costMap) {
+            TileCost cost(options.widthPx, options.heightPx, (float)options.iterations);
+            exporter.exportCostMap(options.output, cost);
+            printCostHistogram(cost);
+        }
+        else if (raw) {
+            exporter.exportRaw(options.output);
+        }
+        else {
+            Colorizer colorizer(Palette::fromName(options.palette), options.colorPeriod, options.cutoff);
+            exporter.setAntialiasing(options.aaSamples, options.aaBudget);
+            exporter.exportImage(options.output, colorizer);
+
+            if (options.aaSamples > 1) {
+                auto statistics = exporter.getAntialiasingStatistics();
+                printf("Anti-aliased %zu pixels with %zu extra samples (%.3f per pixel)\n",
+                    statistics.refinedPixels, statistics.extraSamples, statistics.extraSamples / ((double)options.widthPx * options.heightPx));
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double pixelCount = (double)options.widthPx * options.heightPx;
+
+        printf("Rendered and wrote in %.2f s (%.1f Mpx/s)\n", seconds, pixelCount / seconds / 1e6);
+        printf("Wrote %s\n", options.output.c_str());
+    }
+    catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,10 +1,19 @@
 // Include standard headers
+#include <algorithm>
+#include <chrono>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 
 
+// Include GLEW. Always include it before gl.h and glfw.h, since it's a bit magic.
+#include <GL/glew.h>
+
 // Include GLFW
 #include <glfw3.h>
 
@@ -13,14 +22,23 @@
 
 #include "Screen.h"
 #include "Camera.h"
+#include "CameraPath.h"
+#include "FrameStatistics.h"
 #include "Tile.h"
 #include "OpenClRenderer.h"
 #include "CpuRenderer.h"
 #include "TileSplitter.h"
+#include "ImageWriter.h"
+#include "TileCost.h"
+#include "Trace.h"
+#include "Hud.h"
 
-int main( void )
-{
+#ifdef MANDELBROT_HEADLESS
+#include "HeadlessContext.h"
+#endif
 
+static GLFWwindow* openWindow(int width, int height)
+{
     // Initialise GLFW
     if (!glfwInit())
     {
@@ -34,10 +52,6 @@ int main( void )
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-
-    int width = 1024;
-    int height = 1024;
-
     GLFWwindow* window = glfwCreateWindow(width, height, "Tutorial 05 - Textured Cube", NULL, NULL);
     if (window == nullptr) {
         fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
@@ -46,7 +60,188 @@ int main( void )
     }
     glfwMakeContextCurrent(window);
 
+    // Initialize GLEW, before anything creates GL objects
+    glewExperimental = true; // Needed for core profile
+    if (glewInit() != GLEW_OK) {
+        fprintf(stderr, "Failed to initialize GLEW\n");
+        throw std::runtime_error("Failed to initialize GLEW");
+    }
+
+    return window;
+}
+
+
+// How long a benchmark waits past the end of the path for the view to
+// sharpen, and a headless run for its last frame to
+static const double SETTLE_SECONDS = 30.0;
+
+static void printBenchmark(const FrameStatistics& statistics, const TileSplitter& splitter, const Screen& screen)
+{
+    auto ms = [](double seconds) { return seconds * 1e3; };
+
+    printf("\nFrames: %d\n", statistics.getFrameCount());
+    printf("Frame time (ms):    p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f\n",
+        ms(statistics.getFrameTimePercentile(0.5)), ms(statistics.getFrameTimePercentile(0.9)),
+        ms(statistics.getFrameTimePercentile(0.99)), ms(statistics.getFrameTimePercentile(1.0)));
+    printf("Time to sharp (ms): p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f, %d frames never sharp\n",
+        ms(statistics.getTimeToSharpPercentile(0.5)), ms(statistics.getTimeToSharpPercentile(0.9)),
+        ms(statistics.getTimeToSharpPercentile(0.99)), ms(statistics.getTimeToSharpPercentile(1.0)),
+        statistics.getUnsharpFrameCount());
+    printf("Tiles rendered: %d, %llu bytes of tile textures, %llu bytes of instance data\n",
+        splitter.getRenderedTileCount(), splitter.getRenderedBytes(), screen.getTotalUploadBytes());
+
+    // The one number to compare between builds: it covers both how fast the
+    // tiles render and how smoothly frames keep coming while they do
+    printf("Score, p90 time to sharp: %.2f ms\n", ms(statistics.getTimeToSharpPercentile(0.9)));
+}
+
+// How well the parents' cost maps predicted their children's iterations
+static void printCostModel(const std::vector<TileCost::Record>& records)
+{
+    std::vector<double> errors;
+    for (const auto& record : records) {
+        if (record.predictedIterations >= 0.0 && record.iterations > 0.0) {
+            errors.push_back(fabs(record.predictedIterations - record.iterations) / record.iterations);
+        }
+    }
+
+    if (errors.empty()) {
+        printf("Cost model: no tile had both a prediction and a count\n");
+        return;
+    }
+
+    std::sort(errors.begin(), errors.end());
+    printf("Cost model: %zu tiles predicted, error p50 %.1f%%, p90 %.1f%%\n",
+        errors.size(), errors[errors.size() / 2] * 100, errors[errors.size() * 9 / 10] * 100);
+}
+
+static void printUsage()
+{
+    fprintf(stderr,
+        "Usage: MandelbrotGame [--reproject] [--hud] [--trace trace.json] [--cost-stats costs.json] [--fixed-iterations]\n"
+        "                      [--record path.txt | --replay path.txt | --benchmark path.txt]\n"
+        "                      [--headless [frames] [output.png|output.ppm]]\n");
+}
+
+// Arguments as printUsage() shows them. Anything else is an error.
+// --headless writes the view after the last frame, once it is sharp.
+// R toggles reprojection in the window, H the performance overlay, A
+// anti-aliasing.
+// --record saves the camera of every frame, --replay moves the camera along
+// a saved path instead of the built-in zoom. --benchmark replays a path
+// headlessly and reports frame times and how long the view took to sharpen.
+// --trace records where the time goes, for chrome://tracing or Perfetto.
+// --cost-stats writes every rendered tile's iteration histogram and cost
+// map, with the iterations its parent predicted for it.
+// --fixed-iterations keeps the root's maxIt for every tile, instead of
+// picking each split's from the parent's histogram.
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    bool reproject = false;
+    bool showHud = false;
+    std::string recordPath;
+    std::string replayPath;
+    bool benchmark = false;
+    std::string tracePath;
+    std::string costStatsPath;
+    bool fixedIterations = false;
+    bool headless = false;
+    int headlessFrames = 600;
+    std::string outputPath;
+
+    while (!args.empty()) {
+        if (args[0] == "--reproject") {
+            reproject = true;
+            args.erase(args.begin());
+        }
+        else if (args[0] == "--hud") {
+            showHud = true;
+            args.erase(args.begin());
+        }
+        else if (args[0] == "--fixed-iterations") {
+            fixedIterations = true;
+            args.erase(args.begin());
+        }
+        else if (args[0] == "--trace" && args.size() > 1) {
+            tracePath = args[1];
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        else if (args[0] == "--cost-stats" && args.size() > 1) {
+            costStatsPath = args[1];
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        else if (args[0] == "--record" && args.size() > 1) {
+            recordPath = args[1];
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        else if ((args[0] == "--replay" || args[0] == "--benchmark") && args.size() > 1) {
+            replayPath = args[1];
+            benchmark = args[0] == "--benchmark";
+            args.erase(args.begin(), args.begin() + 2);
+        }
+        else if (args[0] == "--headless") {
+            headless = true;
+            args.erase(args.begin());
+
+            // Then a frame count, and an output path after it, both optional
+            if (!args.empty() && args[0].compare(0, 2, "--") != 0) {
+                char* end = nullptr;
+                long frames = strtol(args[0].c_str(), &end, 10);
+                if (*end != '\0' || frames <= 0) {
+                    fprintf(stderr, "Not a frame count: %s\n", args[0].c_str());
+                    printUsage();
+                    return 1;
+                }
+                headlessFrames = (int)frames;
+                args.erase(args.begin());
+            }
+            if (!args.empty() && args[0].compare(0, 2, "--") != 0) {
+                outputPath = args[0];
+                args.erase(args.begin());
+            }
+        }
+        else {
+            fprintf(stderr, "Unknown argument: %s\n", args[0].c_str());
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!tracePath.empty()) {
+        Trace::setThreadName("Main");
+        Trace::setEnabled(true);
+    }
+
+    CameraPath replay;
+    if (!replayPath.empty()) {
+        replay = CameraPath::load(replayPath);
+    }
+    CameraPath recording;
+
+    headless = headless || benchmark;
+
+    int width = 1024;
+    int height = 1024;
 
+    GLFWwindow* window = nullptr;
+#ifdef MANDELBROT_HEADLESS
+    // Declared first, so the context outlives every GL object below
+    std::unique_ptr<HeadlessContext> headlessContext;
+#endif
+
+    if (headless) {
+#ifdef MANDELBROT_HEADLESS
+        headlessContext.reset(new HeadlessContext(width, height));
+#else
+        fprintf(stderr, "Built without headless support, reconfigure with MANDELBROT_HEADLESS\n");
+        return 1;
+#endif
+    }
+    else {
+        window = openWindow(width, height);
+    }
 
     Camera camera;
     camera.setCenter(-0.743643887037158704752191506114774, -0.131825904205311970493132056385139);
@@ -56,37 +251,185 @@ int main( void )
     TileSplitter splitter(camera, Tile::Bounds{ -2.5f, 1.5f, -2.f, 2.f, 1000.f });
 
 
+    splitter.setRecordCosts(!costStatsPath.empty());
+    splitter.setAdaptiveIterations(!fixedIterations);
+
     Screen screen(camera, splitter);
 
+    screen.setReprojection(reproject);
+    splitter.setReprojection(reproject);
+    bool reprojectKeyWasDown = false;
+
+    Hud hud;
+    hud.setVisible(showHud);
+    bool hudKeyWasDown = false;
+
+    bool antialiasing = true;
+    bool antialiasingKeyWasDown = false;
 
     double zoom = 0.5;
 
 
     int frameNum = 0;
 
-    do{
+    FrameStatistics statistics;
+    auto startTime = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    };
+
+    double lastFrameStart = 0.0;
+
+    while (true) {
         ++frameNum;
 
-        zoom *= 1.001;
+        Trace::Span frameSpan("frame");
+
+        double frameStart = elapsed();
+        double frameSeconds = frameStart - lastFrameStart;
+        lastFrameStart = frameStart;
+
+        if (!replay.isEmpty()) {
+            if (frameStart > replay.getDuration()) {
+                // A benchmark holds the last view until it is sharp
+                if (!benchmark || splitter.isSharp() || frameStart > replay.getDuration() + SETTLE_SECONDS)
+                    break;
+            }
+            replay.apply(frameStart, camera);
+        }
+        else {
+            zoom *= 1.001;
 
-        camera.setZoom(zoom);
-        camera.setCutoff(frameNum / 100.0);
+            camera.setZoom(zoom);
+            camera.setCutoff(frameNum / 100.0);
+        }
+
+        // Tile uploads happen while splitting, so they are timed too
+        hud.beginGpuTimer();
 
         splitter.splitAsNeeded();
 
         screen.draw();
 
+        hud.endGpuTimer();
+        hud.draw(frameSeconds, splitter);
+
+        if (benchmark) {
+            // Nothing is on screen until the GPU is done with it
+            glFinish();
+
+            if (frameStart <= replay.getDuration()) {
+                statistics.addFrame(frameStart, elapsed() - frameStart);
+            }
+            if (splitter.isSharp()) {
+                statistics.setSharp(elapsed());
+            }
+        }
+
+        if (!recordPath.empty()) {
+            recording.record(frameStart, camera);
+        }
+
+        if (frameNum % 600 == 0) {
+            printf("Drawing %d of %zu tiles. Instance buffer: %zu bytes this frame, %llu bytes over %d frames\n",
+                screen.getDrawnTileCount(), splitter.getTiles().size(),
+                screen.getFrameUploadBytes(), screen.getTotalUploadBytes(), frameNum);
+            if (reproject) {
+                printf("Reprojection: %d of %d cells need new tiles\n",
+                    splitter.getReprojectionGrid().getMarkedCount(), ReprojectionGrid::SIZE * ReprojectionGrid::SIZE);
+            }
+        }
+
+        if (window == nullptr) {
+            if (replay.isEmpty() && frameNum >= headlessFrames)
+                break;
+            continue;
+        }
+
         // Swap buffers
         glfwSwapBuffers(window);
 
         glfwPollEvents();
 
-    } // Check if the ESC key was pressed or the window was closed
-    while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
-           glfwWindowShouldClose(window) == 0 );
+        bool reprojectKeyDown = glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS;
+        if (reprojectKeyDown && !reprojectKeyWasDown) {
+            reproject = !reproject;
+            screen.setReprojection(reproject);
+            splitter.setReprojection(reproject);
+            printf("Reprojection %s\n", reproject ? "on" : "off");
+        }
+        reprojectKeyWasDown = reprojectKeyDown;
+
+        bool hudKeyDown = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+        if (hudKeyDown && !hudKeyWasDown) {
+            hud.setVisible(!hud.isVisible());
+        }
+        hudKeyWasDown = hudKeyDown;
+
+        bool antialiasingKeyDown = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+        if (antialiasingKeyDown && !antialiasingKeyWasDown) {
+            antialiasing = !antialiasing;
+            screen.setAntialiasing(antialiasing);
+            printf("Anti-aliasing %s\n", antialiasing ? "on" : "off");
+        }
+        antialiasingKeyWasDown = antialiasingKeyDown;
+
+        // Check if the ESC key was pressed or the window was closed
+        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window) != 0)
+            break;
+    }
+
+    if (benchmark) {
+        printBenchmark(statistics, splitter, screen);
+    }
+
+    if (!tracePath.empty()) {
+        Trace::setEnabled(false);
+        Trace::writeChromeJson(tracePath);
+        printf("Wrote the trace to %s\n", tracePath.c_str());
+    }
 
-    // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    if (!costStatsPath.empty()) {
+        TileCost::writeJson(costStatsPath, splitter.getCostRecords());
+        printf("Wrote the costs of %zu tiles to %s\n", splitter.getCostRecords().size(), costStatsPath.c_str());
+        printCostModel(splitter.getCostRecords());
+    }
+
+    if (!recordPath.empty()) {
+        recording.save(recordPath);
+        printf("Recorded the camera path to %s\n", recordPath.c_str());
+    }
+
+#ifdef MANDELBROT_HEADLESS
+    if (headlessContext && !outputPath.empty()) {
+        // How far the tiles got by the last frame depends on the machine,
+        // so the view holds still until all of them are done
+        double settleStart = elapsed();
+        while (!splitter.isSharp() || !screen.isSettled()) {
+            if (elapsed() - settleStart > SETTLE_SECONDS) {
+                fprintf(stderr, "The view didn't sharpen within %.0f s, writing it as it is\n", SETTLE_SECONDS);
+                break;
+            }
+
+            double frameStart = elapsed();
+            splitter.splitAsNeeded();
+            screen.draw();
+            hud.draw(frameStart - lastFrameStart, splitter);
+            lastFrameStart = frameStart;
+            glFinish();
+        }
+
+        std::vector<unsigned char> frame;
+        headlessContext->readFrame(frame);
+        ImageWriter::write(outputPath, width, height, frame.data());
+        printf("Wrote frame %d to %s\n", frameNum, outputPath.c_str());
+    }
+#endif
+
+    if (window != nullptr) {
+        // Close OpenGL window and terminate GLFW
+        glfwTerminate();
+    }
 
     return 0;
 }